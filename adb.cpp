@@ -1,9 +1,16 @@
 #include <vector>
+#include <map>
+#include <set>
 #include <iostream>
 
 #include "adb.h"
 #include "crypto.h"
 #include "comparator.h"
+#include "common.h"
+#include "prefetch_env.h"
+
+#include "leveldb/write_batch.h"
+#include "helpers/memenv/memenv.h"
 
 #include "boost/filesystem/operations.hpp"
 #include "boost/filesystem/string_file.hpp"
@@ -24,6 +31,9 @@ static const std::string STATIC_OBFUSCATION_KEY = "HWANToDk3L6hcXryaU95X6fasmufN
 
 static Code42AES256RandomIV aes256;
 
+// Tables up to this size are read into memory in one go when prefetching, larger ones are memory-mapped
+static const size_t MAX_PREFETCH_FILE_SIZE = 8 * 1024 * 1024;
+
 std::pair<std::string, std::string> makeMacPlatformIDFromSerial(const std::string &serial) {
     std::string output = serial + serial + serial + serial + "\n";
 
@@ -164,7 +174,7 @@ std::string ADB::pickObfuscationKey(const std::string &macOSSerial, const std::s
     for (std::string &candidate : candidates) {
         // First see if the dedicated sentinel value is present in the database and readable using that key:
         std::string valueEncrypted;
-        leveldb::Status status = db->Get(leveldb::ReadOptions(), ADB_KEY_PREFIX "ACCESSIBLE_KEY", &valueEncrypted);
+        leveldb::Status status = db->Get(leveldb::ReadOptions(), ADB_ACCESSIBLE_KEY, &valueEncrypted);
 
         if (status.ok()) {
             std::string accessibleValue;
@@ -195,7 +205,7 @@ std::string ADB::pickObfuscationKey(const std::string &macOSSerial, const std::s
     // We'll ignore the case where the database is empty since this should not happen in practice
     for (std::string &candidate : candidates) {
         bool success = true;
-        leveldb::Iterator *it = db->NewIterator(leveldb::ReadOptions());
+        leveldb::Iterator *it = db->NewIterator(scanOptions());
 
         for (it->SeekToFirst(); it->Valid(); it->Next()) {
             std::string valueEncrypted = it->value().ToString();
@@ -257,55 +267,446 @@ std::string ADB::obfuscate(const std::string &value) {
     return aes256.encrypt(value, obfuscationKey);
 }
 
-ADB::ADB(const std::string &adbPath, const std::string &macOSSerial, const std::string &linuxSerial) {
+ADB::ADB(const std::string &adbPath, const std::string &macOSSerial, const std::string &linuxSerial,
+        const ADBOptions &adbOptions) : path(adbPath), adbOptions(adbOptions), journal(getJournalPath(adbPath), adbOptions.undoJournalMaxSize) {
 	leveldb::Options options;
-	auto *comp = new Code42Comparator();
-
-	options.create_if_missing = false;
-	options.compression = leveldb::CompressionType::kNoCompression;
-	options.comparator = comp;
 
-	leveldb::Status status = leveldb::DB::Open(options, adbPath, &db);
-
-	if (!status.ok()) {
-		throw std::runtime_error(status.ToString());
+	db = nullptr;
+	env = nullptr;
+	comparator = nullptr;
+	blockCache = nullptr;
+	filterPolicy = nullptr;
+
+	try {
+		comparator = new Code42Comparator();
+		blockCache = adbOptions.blockCacheSize > 0 ? leveldb::NewLRUCache(adbOptions.blockCacheSize) : nullptr;
+		filterPolicy = adbOptions.bloomFilterBitsPerKey > 0 ? leveldb::NewBloomFilterPolicy(adbOptions.bloomFilterBitsPerKey) : nullptr;
+
+		options.create_if_missing = false;
+		options.compression = leveldb::CompressionType::kNoCompression;
+		options.comparator = comparator;
+		options.block_cache = blockCache;
+		options.filter_policy = filterPolicy;
+
+		if (adbOptions.inMemory) {
+			env = loadIntoMemEnv(adbPath);
+			options.env = env;
+		} else if (adbOptions.prefetchTables) {
+			PrefetchEnv *prefetchEnv = new PrefetchEnv(leveldb::Env::Default(), MAX_PREFETCH_FILE_SIZE);
+
+			env = prefetchEnv;
+			options.env = env;
+
+			prefetchEnv->prefetch(adbPath, adbOptions.prefetchThreads);
+		}
+
+		if (adbOptions.maxOpenFiles > 0) {
+			options.max_open_files = adbOptions.maxOpenFiles;
+		}
+
+		// Otherwise opening the database always writes a new MANIFEST and log (and flushes the old log to a table),
+		// even if we then skip every write
+		options.reuse_logs = adbOptions.skipUnchangedWrites;
+
+		leveldb::Status status = leveldb::DB::Open(options, adbPath, &db);
+
+		if (!status.ok()) {
+			throw std::runtime_error(status.ToString());
+		}
+
+		obfuscationKey = pickObfuscationKey(macOSSerial, linuxSerial);
+	} catch (...) {
+		// The destructor won't run, and we mustn't keep holding LevelDB's lock on the database
+		close();
+		throw;
 	}
-
-    obfuscationKey = pickObfuscationKey(macOSSerial, linuxSerial);
 }
 
 ADB::~ADB() {
+    close();
+}
+
+void ADB::close() {
     // Important that this gets called because LevelDB could have pending writes it needs to flush 
     delete db;
+    delete comparator;
+    delete blockCache;
+    delete filterPolicy;
+    delete env;
+
+    db = nullptr;
+    comparator = nullptr;
+    blockCache = nullptr;
+    filterPolicy = nullptr;
+    env = nullptr;
 }
 
-std::string ADB::readKey(const std::string &key) {
+/**
+ * Create an in-memory Env holding a copy of every file in the database directory (at the same path), so that the
+ * database can be opened from there without the original files ever being modified.
+ */
+leveldb::Env *ADB::loadIntoMemEnv(const std::string &adbPath) {
+    leveldb::Env *diskEnv = leveldb::Env::Default();
+    std::vector<std::string> children;
+    leveldb::Status status = diskEnv->GetChildren(adbPath, &children);
+
+    if (!status.ok()) {
+        throw std::runtime_error(status.ToString());
+    }
+
+    leveldb::Env *memEnv = leveldb::NewMemEnv(diskEnv);
+
+    for (auto &child : children) {
+        std::string filename = adbPath + "/" + child;
+        std::string contents;
+
+        // CrashPlan may hold the lock on the real database, but that doesn't matter to our copy
+        if (child == "." || child == ".." || child == "LOCK" || !boost::filesystem::is_regular_file(filename)) {
+            continue;
+        }
+
+        status = leveldb::ReadFileToString(diskEnv, filename, &contents);
+
+        if (status.ok()) {
+            status = leveldb::WriteStringToFile(memEnv, contents, filename);
+        }
+
+        if (!status.ok()) {
+            delete memEnv;
+            throw std::runtime_error(status.ToString());
+        }
+    }
+
+    return memEnv;
+}
+
+leveldb::ReadOptions ADB::scanOptions() const {
+    leveldb::ReadOptions result;
+
+    result.fill_cache = adbOptions.fillCacheOnScan;
+
+    return result;
+}
+
+std::string ADB::readKey(const leveldb::Slice &key) {
 	std::string value;
 	leveldb::Status status = db->Get(leveldb::ReadOptions(), key, &value);
 
 	if (status.ok()) {
 		return deobfuscate(value);
+	} else if (status.IsNotFound()) {
+		throw ADBKeyNotFoundException("Failed to fetch " + key.ToString() + ": " + status.ToString());
 	} else {
-		throw std::runtime_error("Failed to fetch " + key + ": " + status.ToString());
+		throw std::runtime_error("Failed to fetch " + key.ToString() + ": " + status.ToString());
 	}
 }
 
-void ADB::deleteKey(const std::string &key) {
-    if (!db->Delete(leveldb::WriteOptions(), key).ok()) {
-        throw std::runtime_error("Failed to delete " + key);
+void ADB::deleteKey(const leveldb::Slice &key) {
+    ADBBatch batch;
+
+    batch.remove(key);
+
+    apply(batch);
+}
+
+void ADB::writeKey(const leveldb::Slice &key, const leveldb::Slice &value) {
+    ADBBatch batch;
+
+    batch.put(key, value);
+
+    apply(batch);
+}
+
+/**
+ * Check whether the edit would leave the key's current (plaintext) value as it is.
+ */
+bool ADB::isUnchanged(const ADBBatch::Edit &edit) {
+    std::string current;
+    leveldb::Status status = db->Get(leveldb::ReadOptions(), edit.key, &current);
+
+    if (status.IsNotFound()) {
+        return edit.type == ADBBatch::Edit::REMOVE;
+    }
+
+    if (!status.ok() || edit.type == ADBBatch::Edit::REMOVE) {
+        return false;
+    }
+
+    if (edit.type == ADBBatch::Edit::PUT_OBFUSCATED && edit.value == current) {
+        return true;
+    }
+
+    try {
+        return deobfuscate(current) == (edit.type == ADBBatch::Edit::PUT ? edit.value : deobfuscate(edit.value));
+    } catch (std::runtime_error &e) {
+        // Values we can't decrypt are always overwritten
+        return false;
+    }
+}
+
+/**
+ * Obfuscate and commit all of the edits in the batch in a single atomic write.
+ *
+ * If skipUnchangedWrites is set, edits which wouldn't change a key's value are dropped from the batch first (and
+ * counted, see getSkippedWriteCount()). If that leaves nothing to do, nothing is written.
+ */
+void ADB::apply(const ADBBatch &batch) {
+    std::vector<char> skip(batch.edits.size(), false);
+
+    if (adbOptions.skipUnchangedWrites) {
+        std::vector<char> candidate(batch.edits.size(), false);
+        std::set<std::string> seen;
+
+        // A key's current value only tells us about the first edit to it in the batch
+        for (size_t i = 0; i < batch.edits.size(); i++) {
+            candidate[i] = seen.insert(batch.edits[i].key).second;
+        }
+
+        parallelFor(batch.edits.size(), [&](size_t i) {
+            skip[i] = candidate[i] && isUnchanged(batch.edits[i]);
+        });
+    }
+
+    std::vector<std::string> obfuscated(batch.edits.size());
+
+    parallelFor(batch.edits.size(), [&](size_t i) {
+        if (batch.edits[i].type == ADBBatch::Edit::PUT && !skip[i]) {
+            obfuscated[i] = obfuscate(batch.edits[i].value);
+        }
+    });
+
+    leveldb::WriteBatch writeBatch;
+    std::vector<std::string> keys;
+
+    for (size_t i = 0; i < batch.edits.size(); i++) {
+        const ADBBatch::Edit &edit = batch.edits[i];
+
+        if (skip[i]) {
+            skippedWrites++;
+            continue;
+        }
+
+        switch (edit.type) {
+            case ADBBatch::Edit::PUT:
+                writeBatch.Put(edit.key, obfuscated[i]);
+                break;
+            case ADBBatch::Edit::PUT_OBFUSCATED:
+                writeBatch.Put(edit.key, edit.value);
+                break;
+            case ADBBatch::Edit::REMOVE:
+                writeBatch.Delete(edit.key);
+                break;
+        }
+
+        keys.push_back(edit.key);
+    }
+
+    if (keys.empty()) {
+        return;
+    }
+
+    leveldb::Status status = writeJournaled(leveldb::WriteOptions(), writeBatch, keys);
+
+    if (!status.ok()) {
+        if (batch.edits.size() == 1) {
+            throw std::runtime_error("Failed to " + std::string(batch.edits[0].type == ADBBatch::Edit::REMOVE ? "delete " : "write to ") 
+                + batch.edits[0].key + ": " + status.ToString());
+        }
+
+        throw std::runtime_error("Failed to write batch: " + status.ToString());
+    }
+}
+
+size_t ADB::getSkippedWriteCount() const {
+    return skippedWrites;
+}
+
+/**
+ * The undo journal lives next to the database directory, e.g. "adb.c42undo" for "adb".
+ */
+std::string ADB::getJournalPath(const std::string &adbPath) {
+    boost::filesystem::path dir(adbPath);
+
+    // Ignore any trailing slash
+    if (dir.filename() == "." && dir.has_parent_path()) {
+        dir = dir.parent_path();
+    }
+
+    return dir.string() + ".c42undo";
+}
+
+/**
+ * Durably record the current values of the given keys in the undo journal, and then commit the batch which changes
+ * them. If the commit fails, the journal record is dropped again.
+ */
+leveldb::Status ADB::writeJournaled(const leveldb::WriteOptions &writeOptions, leveldb::WriteBatch &writeBatch,
+        const std::vector<std::string> &keys) {
+    if (!adbOptions.undoJournal || adbOptions.inMemory) {
+        return db->Write(writeOptions, &writeBatch);
+    }
+
+    std::vector<UndoJournal::Entry> entries;
+    std::set<std::string> seen;
+
+    for (auto &key : keys) {
+        if (!seen.insert(key).second) {
+            continue;
+        }
+
+        UndoJournal::Entry entry;
+        leveldb::Status status = db->Get(leveldb::ReadOptions(), key, &entry.previousValue);
+
+        if (!status.ok() && !status.IsNotFound()) {
+            return status;
+        }
+
+        entry.key = key;
+        entry.existed = status.ok();
+
+        entries.push_back(entry);
+    }
+
+    bool continuesGroup = undoGroupDepth > 0 && undoGroupJournaled;
+    uint64_t offset = journal.append(entries, continuesGroup);
+
+    leveldb::Status status = db->Write(writeOptions, &writeBatch);
+
+    if (status.ok()) {
+        undoGroupJournaled = undoGroupDepth > 0;
+    } else {
+        // Otherwise a later undo would revert this edit which never happened, instead of the user's real last edit
+        journal.truncate(offset);
+    }
+
+    return status;
+}
+
+/**
+ * Edits applied between beginUndoGroup() and the matching endUndoGroup() are recorded as a single transaction in the
+ * undo journal. Groups may be nested. See ADBUndoGroup.
+ */
+void ADB::beginUndoGroup() {
+    if (undoGroupDepth++ == 0) {
+        undoGroupJournaled = false;
     }
 }
 
-void ADB::writeKey(const std::string &key, const std::string &value) {
-    leveldb::Status status = db->Put(leveldb::WriteOptions(), key, obfuscate(value));
+void ADB::endUndoGroup() {
+    undoGroupDepth--;
+}
+
+/**
+ * Roll back the most recent edit recorded in the undo journal (or every edit, if all is true), restoring the
+ * previous values of the keys it touched in a single WriteBatch.
+ *
+ * @return the number of keys restored
+ */
+size_t ADB::undo(bool all) {
+    std::vector<UndoJournal::Transaction> transactions = journal.readAll();
+
+    if (transactions.empty()) {
+        throw std::runtime_error("There are no edits to undo in " + journal.getPath());
+    }
+
+    size_t first = all ? 0 : transactions.size() - 1;
+    std::map<std::string, const UndoJournal::Entry *> restore;
+
+    // Where a key was touched by several of the edits, the oldest previous value is the one to go back to
+    for (size_t i = transactions.size(); i-- > first; ) {
+        for (auto &entry : transactions[i].entries) {
+            restore[entry.key] = &entry;
+        }
+    }
+
+    leveldb::WriteBatch batch;
+
+    for (auto &pair : restore) {
+        if (pair.second->existed) {
+            batch.Put(pair.first, pair.second->previousValue);
+        } else {
+            batch.Delete(pair.first);
+        }
+    }
+
+    leveldb::WriteOptions writeOptions;
+    writeOptions.sync = true;
+
+    leveldb::Status status = db->Write(writeOptions, &batch);
 
     if (!status.ok()) {
-        throw std::runtime_error("Failed to write to " + key + ": " + status.ToString());
+        throw std::runtime_error("Failed to write restored values: " + status.ToString());
+    }
+
+    // If we crash before this, the same edits will just be undone again next time
+    if (!adbOptions.inMemory) {
+        journal.truncate(transactions[first].offset);
     }
+
+    return restore.size();
+}
+
+std::unique_ptr<ADBIterator> ADB::newIterator() {
+    return std::unique_ptr<ADBIterator>(new ADBIterator(*this));
+}
+
+const std::string &ADB::getPath() const {
+    return path;
+}
+
+/**
+ * The Env that the database's files are accessed through.
+ */
+leveldb::Env *ADB::getEnv() const {
+    return env ? env : leveldb::Env::Default();
+}
+
+/**
+ * Fetch one of LevelDB's DB::GetProperty() properties, or an empty string if it isn't recognised.
+ */
+std::string ADB::getProperty(const std::string &name) {
+    std::string value;
+
+    if (!db->GetProperty(name, &value)) {
+        return "";
+    }
+
+    return value;
+}
+
+/**
+ * Approximate size on disk of the keys in the range [start, limit).
+ */
+uint64_t ADB::getApproximateSize(const std::string &start, const std::string &limit) {
+    leveldb::Range range(start, limit);
+    uint64_t size;
+
+    db->GetApproximateSizes(&range, 1, &size);
+
+    return size;
+}
+
+/**
+ * Identifies the obfuscation key without revealing it, so that exported ciphertext can be matched to a database
+ * which uses the same key.
+ */
+/**
+ * Identifies the obfuscation key without revealing it, so that obfuscated values can be checked to belong to this
+ * database before they're written into it.
+ *
+ * Throws if the database is protected with DPAPI on Windows instead of an obfuscation key, since then there's no key
+ * we could identify (and every DPAPI database would otherwise share the same fingerprint).
+ */
+std::string ADB::getKeyFingerprint() const {
+    if (obfuscationKey.empty()) {
+        throw std::runtime_error("This database is protected by Windows DPAPI rather than an obfuscation key, so its "
+            "encrypted values can't be moved to another database, use plaintext values instead");
+    }
+
+    return keyFingerprint(obfuscationKey);
 }
 
 bool ADB::readAllKeys(std::vector<std::string> &result) {
-	leveldb::Iterator *it = db->NewIterator(leveldb::ReadOptions());
+	leveldb::Iterator *it = db->NewIterator(scanOptions());
 
 	for (it->SeekToFirst(); it->Valid(); it->Next()) {
 		result.push_back(it->key().ToString());
@@ -319,7 +720,7 @@ bool ADB::readAllKeys(std::vector<std::string> &result) {
 }
 
 bool ADB::readAllEntries(std::vector<std::pair<std::string, std::string>> &result) {
-    leveldb::Iterator *it = db->NewIterator(leveldb::ReadOptions());
+    leveldb::Iterator *it = db->NewIterator(scanOptions());
 
     for (it->SeekToFirst(); it->Valid(); it->Next()) {
         /*
@@ -334,4 +735,234 @@ bool ADB::readAllEntries(std::vector<std::pair<std::string, std::string>> &resul
     delete it;
 
     return success;
-}
\ No newline at end of file
+}
+
+/**
+ * Call the callback for each key in the database which isn't in the given set, for deleting the keys which a
+ * snapshot doesn't have. The ACCESSIBLE_KEY sentinel is never visited, since without it we'd no longer be able to
+ * tell which obfuscation key the database uses.
+ *
+ * @return the number of keys visited
+ */
+size_t ADB::forEachKeyNotIn(const std::unordered_set<std::string> &keys,
+        const std::function<void(const std::string &key)> &callback) {
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(scanOptions()));
+    size_t count = 0;
+
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        std::string key = it->key().ToString();
+
+        if (key != ADB_ACCESSIBLE_KEY && keys.count(key) == 0) {
+            callback(key);
+            count++;
+        }
+    }
+
+    if (!it->status().ok()) {
+        throw std::runtime_error("Failed to read all entries from database: " + it->status().ToString());
+    }
+
+    return count;
+}
+
+/**
+ * Derive the obfuscation key that CrashPlan would use on a machine with the given serial, without consulting any
+ * database. If neither serial is supplied, the static CrashPlan Home key is returned.
+ */
+std::string ADB::makeObfuscationKey(const std::string &macOSSerial, const std::string &linuxSerial) {
+    std::pair<std::string, std::string> platformID;
+
+    if (macOSSerial.length() > 0) {
+        platformID = makeMacPlatformIDFromSerial(macOSSerial);
+    } else if (linuxSerial.length() > 0) {
+        platformID = makeLinuxPlatformIDFromSerial(linuxSerial);
+    } else {
+        return STATIC_OBFUSCATION_KEY;
+    }
+
+    if (platformID.first.length() < 32) {
+        throw std::runtime_error("Serial number is too short to derive an obfuscation key from");
+    }
+
+    return generateSmallBusinessKeyV2(platformID.first, platformID.second);
+}
+
+/**
+ * Re-encrypt every value in the database using a new obfuscation key, and write a fresh ACCESSIBLE_KEY sentinel so
+ * CrashPlan will recognise the new key.
+ *
+ * Every value is decrypted and re-encrypted (in parallel) before anything is written, and the result is committed as
+ * a single WriteBatch, so the database is never left holding a mixture of old and new keys.
+ *
+ * @return the number of entries that were re-encrypted
+ */
+size_t ADB::rekey(const std::string &newObfuscationKey) {
+    if (newObfuscationKey.empty()) {
+        throw std::runtime_error("No obfuscation key available!");
+    }
+
+    std::vector<std::pair<std::string, std::string>> entries;
+
+    leveldb::ReadOptions readOptions = scanOptions();
+    readOptions.snapshot = db->GetSnapshot();
+
+    leveldb::Iterator *it = db->NewIterator(readOptions);
+
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        entries.push_back(std::pair<std::string, std::string>(it->key().ToString(), it->value().ToString()));
+    }
+
+    bool success = it->status().ok();
+
+    delete it;
+    db->ReleaseSnapshot(readOptions.snapshot);
+
+    if (!success) {
+        throw std::runtime_error("Failed to read all entries from database");
+    }
+
+    parallelFor(entries.size(), [&](size_t i) {
+        entries[i].second = aes256.encrypt(deobfuscate(entries[i].second), newObfuscationKey);
+    });
+
+    leveldb::WriteBatch batch;
+
+    for (auto &entry : entries) {
+        batch.Put(entry.first, entry.second);
+    }
+
+    batch.Put(ADB_ACCESSIBLE_KEY, aes256.encrypt(std::string(16, '\0'), newObfuscationKey));
+
+    std::vector<std::string> keys;
+
+    for (auto &entry : entries) {
+        keys.push_back(entry.first);
+    }
+
+    keys.push_back(ADB_ACCESSIBLE_KEY);
+
+    leveldb::WriteOptions writeOptions;
+    writeOptions.sync = true;
+
+    leveldb::Status status = writeJournaled(writeOptions, batch, keys);
+
+    if (!status.ok()) {
+        throw std::runtime_error("Failed to write re-encrypted values: " + status.ToString());
+    }
+
+    obfuscationKey = newObfuscationKey;
+
+    // Discard the old copies of every value from the tables
+    db->CompactRange(nullptr, nullptr);
+
+    return entries.size();
+}
+
+/**
+ * Rewrite every table in the database, discarding overwritten and deleted values. The key space is split into
+ * several ranges which are compacted one at a time so that progress can be reported.
+ *
+ * @param progress - called after each range is compacted with the number of ranges completed so far
+ */
+void ADB::compact(const std::function<void(size_t done, size_t total)> &progress) {
+    const size_t NUM_RANGES = 10;
+
+    std::vector<std::string> keys;
+
+    if (!readAllKeys(keys)) {
+        throw std::runtime_error("Failed to read all keys from database");
+    }
+
+    // Range boundaries, the first range begins at the start of the database and the last runs to its end:
+    std::vector<std::string> boundaries;
+
+    for (size_t i = 1; i < NUM_RANGES && i * keys.size() / NUM_RANGES < keys.size(); i++) {
+        const std::string &boundary = keys[i * keys.size() / NUM_RANGES];
+
+        if (boundaries.empty() || boundaries.back() != boundary) {
+            boundaries.push_back(boundary);
+        }
+    }
+
+    size_t total = boundaries.size() + 1;
+
+    for (size_t i = 0; i < total; i++) {
+        leveldb::Slice begin, end;
+
+        if (i > 0) {
+            begin = boundaries[i - 1];
+        }
+        if (i < boundaries.size()) {
+            end = boundaries[i];
+        }
+
+        db->CompactRange(i > 0 ? &begin : nullptr, i < boundaries.size() ? &end : nullptr);
+
+        progress(i + 1, total);
+    }
+}
+
+void ADBBatch::put(const leveldb::Slice &key, const leveldb::Slice &value) {
+    edits.push_back(Edit{Edit::PUT, key.ToString(), value.ToString()});
+}
+
+void ADBBatch::putObfuscated(const leveldb::Slice &key, const leveldb::Slice &value) {
+    edits.push_back(Edit{Edit::PUT_OBFUSCATED, key.ToString(), value.ToString()});
+}
+
+void ADBBatch::remove(const leveldb::Slice &key) {
+    edits.push_back(Edit{Edit::REMOVE, key.ToString(), ""});
+}
+
+void ADBBatch::clear() {
+    edits.clear();
+}
+
+/**
+ * Iterates over a consistent snapshot of the database, taken when the iterator is created.
+ */
+ADBIterator::ADBIterator(ADB &adb) : adb(adb) {
+    leveldb::ReadOptions readOptions = adb.scanOptions();
+
+    snapshot = adb.db->GetSnapshot();
+    readOptions.snapshot = snapshot;
+
+    it = adb.db->NewIterator(readOptions);
+}
+
+ADBIterator::~ADBIterator() {
+    delete it;
+    adb.db->ReleaseSnapshot(snapshot);
+}
+
+void ADBIterator::seekToFirst() {
+    it->SeekToFirst();
+}
+
+void ADBIterator::seek(const leveldb::Slice &target) {
+    it->Seek(target);
+}
+
+void ADBIterator::next() {
+    it->Next();
+}
+
+bool ADBIterator::valid() const {
+    return it->Valid();
+}
+
+leveldb::Slice ADBIterator::key() const {
+    return it->key();
+}
+
+leveldb::Slice ADBIterator::rawValue() const {
+    return it->value();
+}
+
+std::string ADBIterator::value() const {
+    return adb.deobfuscate(it->value().ToString());
+}
+
+leveldb::Status ADBIterator::status() const {
+    return it->status();
+}
@@ -1,34 +1,219 @@
 #pragma once
 
 #include <vector>
+#include <unordered_set>
 #include <utility>
 #include <string>
+#include <memory>
+#include <stdexcept>
+#include <functional>
 
 #include "leveldb/db.h"
+#include "leveldb/cache.h"
+#include "leveldb/filter_policy.h"
+#include "leveldb/write_batch.h"
+
+#include "journal.h"
+#include "leveldb/slice.h"
 
 // Keys in CrashPlan ADB databases start with this byte, so be sure to include 
 // it in any read or write operations or else CrashPlan won't see the values
 #define ADB_KEY_PREFIX "\x01"
 
+// Sentinel key which CrashPlan uses to check that it has the right obfuscation key, it decrypts to 16 zero bytes
+#define ADB_ACCESSIBLE_KEY ADB_KEY_PREFIX "ACCESSIBLE_KEY"
+
+/**
+ * Tuning options for opening a database, the defaults match LevelDB's own.
+ */
+struct ADBOptions {
+    // Size of the block cache in bytes, or 0 to use LevelDB's default (8MB)
+    size_t blockCacheSize = 0;
+
+    // Maximum number of table files to keep open at once, or 0 to use LevelDB's default (1000)
+    int maxOpenFiles = 0;
+
+    // Whether full scans of the database should populate the block cache (usually a waste, since every block is
+    // only visited once)
+    bool fillCacheOnScan = false;
+
+    // Bits per key for a bloom filter on point lookups, or 0 for no filter. Filters are only built for tables that
+    // are written from now on (e.g. by compaction), older tables continue to be searched without one.
+    int bloomFilterBitsPerKey = 0;
+
+    // Read table files in large chunks (and all up front) rather than with many small reads, for databases on slow
+    // network storage. See PrefetchEnv.
+    bool prefetchTables = false;
+
+    // Number of threads to read tables with when prefetching
+    size_t prefetchThreads = 8;
+
+    // Load a copy of the database into memory and operate on that instead, so that edits never reach the disk
+    bool inMemory = false;
+
+    // Record the previous value of every key we change in an undo journal next to the database (see undo()). This is
+    // never written for in-memory databases.
+    bool undoJournal = true;
+
+    // Once the undo journal would grow past this size, its oldest transactions are discarded to bring it down to half
+    // this size (the most recent transaction is always kept, however large)
+    uint64_t undoJournalMaxSize = 64 * 1024 * 1024;
+
+    // Compare each write with the key's current value and skip it if the plaintext is unchanged (likewise deletes of
+    // keys which don't exist), so that repeatedly enforcing the same settings doesn't rewrite them. This also has
+    // LevelDB reuse the existing MANIFEST and log when opening the database, rather than starting new ones.
+    bool skipUnchangedWrites = false;
+};
+
+class ADBKeyNotFoundException : public std::runtime_error {
+public:
+    explicit ADBKeyNotFoundException(const std::string &message) : std::runtime_error(message) {
+    }
+};
+
+/**
+ * A list of writes and deletes to be committed to the database atomically by ADB::apply(). Values supplied to put()
+ * are plaintext and are obfuscated when the batch is applied, values supplied to putObfuscated() are written as-is.
+ */
+class ADBBatch {
+public:
+    struct Edit {
+        enum Type {
+            PUT,
+            PUT_OBFUSCATED,
+            REMOVE
+        };
+
+        Type type;
+        std::string key;
+        std::string value;
+    };
+
+    std::vector<Edit> edits;
+
+    void put(const leveldb::Slice &key, const leveldb::Slice &value);
+    void putObfuscated(const leveldb::Slice &key, const leveldb::Slice &value);
+    void remove(const leveldb::Slice &key);
+    void clear();
+};
+
+class ADB;
+
+/**
+ * Iterates over the raw keys of the database in order, decrypting values on request.
+ */
+class ADBIterator {
+private:
+    ADB &adb;
+    const leveldb::Snapshot *snapshot;
+    leveldb::Iterator *it;
+
+public:
+    explicit ADBIterator(ADB &adb);
+    ADBIterator(const ADBIterator &) = delete;
+    ADBIterator &operator=(const ADBIterator &) = delete;
+
+    ~ADBIterator();
+
+    void seekToFirst();
+    void seek(const leveldb::Slice &target);
+    void next();
+    bool valid() const;
+
+    leveldb::Slice key() const;
+    leveldb::Slice rawValue() const;
+    std::string value() const;
+
+    leveldb::Status status() const;
+};
+
 class ADB {
 private:
+    friend class ADBIterator;
+
+    std::string path;
     leveldb::DB *db;
+    leveldb::Env *env;
+    leveldb::Comparator *comparator;
+    leveldb::Cache *blockCache;
+    const leveldb::FilterPolicy *filterPolicy;
+    ADBOptions adbOptions;
+    UndoJournal journal;
     std::string obfuscationKey;
-    
-    std::string deobfuscate(const std::string &value);
-    std::string obfuscate(const std::string &value);
+    size_t skippedWrites = 0;
+    int undoGroupDepth = 0;
+    bool undoGroupJournaled = false;
 
     std::string pickObfuscationKey(const std::string &macOSSerial, const std::string &linuxSerial);
 
+    leveldb::ReadOptions scanOptions() const;
+
+    void close();
+
+    static leveldb::Env *loadIntoMemEnv(const std::string &adbPath);
+    static std::string getJournalPath(const std::string &adbPath);
+
+    leveldb::Status writeJournaled(const leveldb::WriteOptions &writeOptions, leveldb::WriteBatch &writeBatch,
+        const std::vector<std::string> &keys);
+    bool isUnchanged(const ADBBatch::Edit &edit);
+
 public:
-    ADB(const std::string &adbPath, const std::string &macOSSerial, const std::string &linuxSerial);
+    ADB(const std::string &adbPath, const std::string &macOSSerial, const std::string &linuxSerial,
+        const ADBOptions &options = ADBOptions());
     
     ~ADB();
 
-    std::string readKey(const std::string &key);
-    void writeKey(const std::string &key, const std::string &value);
-    void deleteKey(const std::string &key);
+    std::string deobfuscate(const std::string &value);
+    std::string obfuscate(const std::string &value);
+
+    std::string getKeyFingerprint() const;
+
+    const std::string &getPath() const;
+    leveldb::Env *getEnv() const;
+    std::string getProperty(const std::string &name);
+    uint64_t getApproximateSize(const std::string &start, const std::string &limit);
+
+    std::string readKey(const leveldb::Slice &key);
+    void writeKey(const leveldb::Slice &key, const leveldb::Slice &value);
+    void deleteKey(const leveldb::Slice &key);
+
+    void apply(const ADBBatch &batch);
+    size_t getSkippedWriteCount() const;
+
+    std::unique_ptr<ADBIterator> newIterator();
 
     bool readAllKeys(std::vector<std::string> &result);
     bool readAllEntries(std::vector<std::pair<std::string, std::string>> &result);
-};
\ No newline at end of file
+    size_t forEachKeyNotIn(const std::unordered_set<std::string> &keys,
+        const std::function<void(const std::string &key)> &callback);
+
+    size_t rekey(const std::string &newObfuscationKey);
+
+    void compact(const std::function<void(size_t done, size_t total)> &progress);
+
+    void beginUndoGroup();
+    void endUndoGroup();
+    size_t undo(bool all);
+
+    static std::string makeObfuscationKey(const std::string &macOSSerial, const std::string &linuxSerial);
+};
+/**
+ * Groups every edit applied to the database while it's in scope into a single transaction in the undo journal, so
+ * that undo() rolls them all back together.
+ */
+class ADBUndoGroup {
+private:
+    ADB &adb;
+
+public:
+    explicit ADBUndoGroup(ADB &adb) : adb(adb) {
+        adb.beginUndoGroup();
+    }
+
+    ADBUndoGroup(const ADBUndoGroup &) = delete;
+    ADBUndoGroup &operator=(const ADBUndoGroup &) = delete;
+
+    ~ADBUndoGroup() {
+        adb.endUndoGroup();
+    }
+};
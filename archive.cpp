@@ -0,0 +1,233 @@
+#include <atomic>
+#include <stdexcept>
+#include <unordered_set>
+#include <vector>
+
+#include "boost/filesystem/operations.hpp"
+#include "boost/filesystem/string_file.hpp"
+
+#include "archive.h"
+#include "common.h"
+#include "crypto.h"
+
+/*
+ * A content-addressed archive of database snapshots, laid out like so:
+ *
+ *     objects/<first 2 hex digits of hash>/<remaining hex digits>
+ *         Decrypted values, named by their SHA-256 hash, so each distinct value is only stored once no matter how
+ *         many snapshots or keys it appears in
+ *
+ *     manifests/<snapshot name>
+ *         "C42MANI\0", fixed32 version, and then for each entry in the database: string key, 32-byte value hash
+ *
+ * Files are written to a temporary name and then hardlinked (or renamed, to replace a manifest) into place, so several
+ * ingests can safely run against the same archive at once.
+ */
+
+namespace fs = boost::filesystem;
+
+static const std::string MANIFEST_MAGIC("C42MANI\0", 8);
+static const uint32_t MANIFEST_VERSION = 1;
+static const size_t HASH_SIZE = 32;
+
+static fs::path getObjectPath(const fs::path &archivePath, const std::string &hash) {
+    std::string hex = binStringToHex(hash);
+
+    return archivePath / "objects" / hex.substr(0, 2) / hex.substr(2);
+}
+
+static fs::path getManifestPath(const fs::path &archivePath, const std::string &snapshotName) {
+    if (snapshotName.empty() || snapshotName.find_first_of("/\\") != std::string::npos
+            || snapshotName == "." || snapshotName == "..") {
+        throw std::runtime_error("Invalid snapshot name '" + snapshotName + "'");
+    }
+
+    return archivePath / "manifests" / snapshotName;
+}
+
+static fs::path saveTempFile(const fs::path &path, const std::string &contents) {
+    fs::path temp = path.parent_path() / fs::unique_path(".tmp-%%%%-%%%%-%%%%-%%%%");
+
+    fs::create_directories(path.parent_path());
+    // Synced before it's linked into place, so a crash can't leave a truncated file under the final name
+    writeFileDurably(temp.string(), contents, false);
+
+    return temp;
+}
+
+static void saveFileAtomically(const fs::path &path, const std::string &contents) {
+    fs::rename(saveTempFile(path, contents), path);
+}
+
+/**
+ * Atomically create the file with the given contents, unless it already exists.
+ *
+ * @return true if we created the file, false if it already existed (even if another thread or process only just
+ * created it)
+ */
+static bool saveFileIfAbsent(const fs::path &path, const std::string &contents) {
+    fs::path temp = saveTempFile(path, contents);
+    boost::system::error_code error;
+
+    // Unlike a rename, linking fails if the destination already exists
+    fs::create_hard_link(temp, path, error);
+    fs::remove(temp);
+
+    if (!error) {
+        return true;
+    }
+
+    if (fs::exists(path)) {
+        return false;
+    }
+
+    throw fs::filesystem_error("Failed to create file", path, error);
+}
+
+/**
+ * Store every value in the database in the archive (skipping values the archive already holds), and record which
+ * key holds which value in a manifest for the snapshot.
+ *
+ * @param replace - true to replace an existing snapshot with the same name, otherwise that's an error
+ */
+ArchiveIngestResult archiveIngest(ADB &adb, const std::string &archivePath, const std::string &snapshotName,
+        bool replace) {
+    fs::path manifestPath = getManifestPath(archivePath, snapshotName);
+
+    if (!replace && fs::exists(manifestPath)) {
+        throw std::runtime_error("There is already a snapshot named '" + snapshotName + "' in the archive");
+    }
+
+    std::vector<std::pair<std::string, std::string>> entries;
+    std::unique_ptr<ADBIterator> it = adb.newIterator();
+
+    for (it->seekToFirst(); it->valid(); it->next()) {
+        entries.push_back(std::pair<std::string, std::string>(it->key().ToString(), it->rawValue().ToString()));
+    }
+
+    if (!it->status().ok()) {
+        throw std::runtime_error("Failed to read all entries from database: " + it->status().ToString());
+    }
+
+    it.reset();
+
+    std::atomic<size_t> newValues(0);
+
+    // Replaces each entry's ciphertext with the hash of its plaintext
+    parallelFor(entries.size(), [&](size_t i) {
+        std::string value = adb.deobfuscate(entries[i].second);
+        std::string hash = sha256(value);
+        fs::path objectPath = getObjectPath(archivePath, hash);
+
+        boost::system::error_code error;
+        uintmax_t existingSize = fs::file_size(objectPath, error);
+
+        if (error) {
+            if (saveFileIfAbsent(objectPath, value)) {
+                newValues++;
+            }
+        } else if (existingSize != value.length()) {
+            // Truncated by a crash (before objects were synced), so every snapshot using it would fail to restore
+            saveFileAtomically(objectPath, value);
+            newValues++;
+        }
+
+        entries[i].second = hash;
+    });
+
+    std::string manifest(MANIFEST_MAGIC);
+
+    appendFixed32(manifest, MANIFEST_VERSION);
+
+    for (auto &entry : entries) {
+        appendLengthPrefixed(manifest, entry.first);
+        manifest.append(entry.second);
+    }
+
+    if (replace) {
+        saveFileAtomically(manifestPath, manifest);
+    } else if (!saveFileIfAbsent(manifestPath, manifest)) {
+        throw std::runtime_error("There is already a snapshot named '" + snapshotName + "' in the archive");
+    }
+
+    return ArchiveIngestResult{entries.size(), newValues};
+}
+
+/**
+ * Write every entry recorded in the snapshot's manifest back into the database, replacing the values of any keys
+ * that already exist.
+ *
+ * @param deleteMissing - true to also delete keys which aren't in the snapshot, so the database ends up matching it
+ *                        exactly (otherwise the snapshot is merged into the database)
+ */
+ArchiveRestoreResult archiveRestore(ADB &adb, const std::string &archivePath, const std::string &snapshotName,
+        bool deleteMissing) {
+    fs::path manifestPath = getManifestPath(archivePath, snapshotName);
+    std::string manifest;
+
+    if (!fs::exists(manifestPath)) {
+        throw std::runtime_error("No snapshot named '" + snapshotName + "' in the archive");
+    }
+
+    fs::load_string_file(manifestPath, manifest);
+
+    const char *p = manifest.data();
+    const char *limit = p + manifest.length();
+
+    if (manifest.compare(0, MANIFEST_MAGIC.length(), MANIFEST_MAGIC) != 0
+            || manifest.length() < MANIFEST_MAGIC.length() + 4
+            || decodeFixed32(p + MANIFEST_MAGIC.length()) != MANIFEST_VERSION) {
+        throw std::runtime_error("Unsupported manifest format in " + manifestPath.string());
+    }
+
+    std::vector<std::pair<std::string, std::string>> entries;
+
+    for (p += MANIFEST_MAGIC.length() + 4; p < limit; ) {
+        std::pair<std::string, std::string> entry;
+
+        if (!readLengthPrefixed(p, limit, entry.first) || (size_t) (limit - p) < HASH_SIZE) {
+            throw std::runtime_error("Corrupt manifest " + manifestPath.string());
+        }
+
+        entry.second.assign(p, HASH_SIZE);
+        p += HASH_SIZE;
+
+        entries.push_back(entry);
+    }
+
+    // Replaces each entry's hash with the value it names
+    parallelFor(entries.size(), [&](size_t i) {
+        std::string value;
+
+        fs::load_string_file(getObjectPath(archivePath, entries[i].second), value);
+
+        if (sha256(value) != entries[i].second) {
+            throw std::runtime_error("Archived value for " + binStringToHex(entries[i].first) + " is corrupt");
+        }
+
+        entries[i].second = value;
+    });
+
+    ADBBatch batch;
+    ArchiveRestoreResult result = {entries.size(), 0};
+
+    for (auto &entry : entries) {
+        batch.put(entry.first, entry.second);
+    }
+
+    if (deleteMissing) {
+        std::unordered_set<std::string> snapshotKeys;
+
+        for (auto &entry : entries) {
+            snapshotKeys.insert(entry.first);
+        }
+
+        result.deleted = adb.forEachKeyNotIn(snapshotKeys, [&](const std::string &key) {
+            batch.remove(key);
+        });
+    }
+
+    adb.apply(batch);
+
+    return result;
+}
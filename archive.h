@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+
+#include "adb.h"
+
+struct ArchiveIngestResult {
+    size_t entries;
+    size_t newValues;
+};
+
+struct ArchiveRestoreResult {
+    size_t entries;
+    size_t deleted;
+};
+
+ArchiveIngestResult archiveIngest(ADB &adb, const std::string &archivePath, const std::string &snapshotName,
+    bool replace);
+ArchiveRestoreResult archiveRestore(ADB &adb, const std::string &archivePath, const std::string &snapshotName,
+    bool deleteMissing);
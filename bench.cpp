@@ -0,0 +1,131 @@
+/*
+ * Measures point lookup latency for keys that are present and absent in a database, with and without a bloom
+ * filter policy.
+ *
+ * Usage: c42-adbtool-bench [numKeys] [numLookups]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "boost/filesystem/operations.hpp"
+
+#include "leveldb/db.h"
+#include "leveldb/cache.h"
+#include "leveldb/filter_policy.h"
+
+#include "adb.h"
+#include "comparator.h"
+
+static std::string makeKey(int i, bool present) {
+    char buffer[32];
+
+    // Absent keys interleave with the present ones so that they land inside the key range of the tables
+    snprintf(buffer, sizeof(buffer), ADB_KEY_PREFIX "key%08d%c", i, present ? 'a' : 'b');
+
+    return buffer;
+}
+
+static leveldb::Options makeOptions(const leveldb::Comparator *comparator, const leveldb::FilterPolicy *filterPolicy,
+        leveldb::Cache *cache) {
+    leveldb::Options options;
+
+    options.create_if_missing = true;
+    options.compression = leveldb::CompressionType::kNoCompression;
+    options.comparator = comparator;
+    options.filter_policy = filterPolicy;
+    options.block_cache = cache;
+
+    return options;
+}
+
+static void openOrDie(const leveldb::Options &options, const std::string &path, leveldb::DB **db) {
+    leveldb::Status status = leveldb::DB::Open(options, path, db);
+
+    if (!status.ok()) {
+        std::cerr << "Failed to open " << path << ": " << status.ToString() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @return mean lookup time in microseconds
+ */
+static double timeLookups(leveldb::DB *db, int numKeys, int numLookups, bool present) {
+    std::mt19937 random(42);
+    std::uniform_int_distribution<int> pick(0, numKeys - 1);
+    std::string value;
+    int found = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < numLookups; i++) {
+        if (db->Get(leveldb::ReadOptions(), makeKey(pick(random), present), &value).ok()) {
+            found++;
+        }
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+    if (found != (present ? numLookups : 0)) {
+        std::cerr << "Unexpected lookup results (" << found << " found)" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    return elapsed.count() / 1000.0 / numLookups;
+}
+
+static void benchmark(const std::string &path, int numKeys, int numLookups, int bloomBitsPerKey) {
+    Code42Comparator comparator;
+    const leveldb::FilterPolicy *filterPolicy = bloomBitsPerKey > 0 ? leveldb::NewBloomFilterPolicy(bloomBitsPerKey) : nullptr;
+    leveldb::DB *db;
+
+    {
+        openOrDie(makeOptions(&comparator, filterPolicy, nullptr), path, &db);
+
+        std::string value(100, 'x');
+
+        for (int i = 0; i < numKeys; i++) {
+            db->Put(leveldb::WriteOptions(), makeKey(i, true), value);
+        }
+
+        db->CompactRange(nullptr, nullptr);
+
+        delete db;
+    }
+
+    // Reopen with a small cache so that most lookups have to visit the tables
+    leveldb::Cache *cache = leveldb::NewLRUCache(64 * 1024);
+
+    openOrDie(makeOptions(&comparator, filterPolicy, cache), path, &db);
+
+    double positive = timeLookups(db, numKeys, numLookups, true);
+    double negative = timeLookups(db, numKeys, numLookups, false);
+
+    delete db;
+    delete cache;
+    delete filterPolicy;
+
+    leveldb::DestroyDB(path, makeOptions(&comparator, nullptr, nullptr));
+
+    std::cout << (bloomBitsPerKey > 0 ? "bloom " + std::to_string(bloomBitsPerKey) + " bits/key" : "no filter       ")
+        << "  present: " << positive << " us/lookup  absent: " << negative << " us/lookup" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    int numKeys = argc > 1 ? atoi(argv[1]) : 200000;
+    int numLookups = argc > 2 ? atoi(argv[2]) : 100000;
+
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+
+    std::cout << numKeys << " keys, " << numLookups << " lookups of each kind" << std::endl;
+
+    benchmark(path.string(), numKeys, numLookups, 0);
+    benchmark(path.string(), numKeys, numLookups, 10);
+
+    return EXIT_SUCCESS;
+}
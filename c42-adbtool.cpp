@@ -14,6 +14,10 @@
 
 #include "common.h"
 #include "adb.h"
+#include "snapshot.h"
+#include "archive.h"
+#include "stats.h"
+#include "clone.h"
 
 #ifdef _WIN32
 // For SHGetKnownFolderPath
@@ -97,6 +101,23 @@ std::string trimADBKeyPrefix(const std::string &key) {
     return key.substr(1);
 }
 
+std::string formatEntry(const std::string &key, const std::string &value) {
+    bool printable = true;
+
+    for (int i = 0; i < value.length(); i++) {
+        if (value[i] < ' ' || value[i] > '~') {
+            printable = false;
+            break;
+        }
+    }
+
+    if (printable) {
+        return trimADBKeyPrefix(key) + " = " + value;
+    } else {
+        return trimADBKeyPrefix(key) + " (hex) = " + binStringToHex(value);
+    }
+}
+
 void commandListEntries(ADB *adb) {
     std::vector<std::pair<std::string, std::string>> values;
 
@@ -109,21 +130,47 @@ void commandListEntries(ADB *adb) {
             continue;
         }
 
-        bool printable = true;
+        std::cout << formatEntry(pair.first, pair.second) << std::endl;
+    }
+}
 
-        for (int i = 0; i < pair.second.length(); i++) {
-            if (pair.second[i] < ' ' || pair.second[i] > '~') {
-                printable = false;
-                break;
-            }
-        }
+/**
+ * Print the entries which differ between entriesBefore and the current contents of the database. Since this decrypts 
+ * every value in the database, it also verifies that the edits can be read back.
+ */
+void printDryRunDiff(ADB *adb, const std::vector<std::pair<std::string, std::string>> &entriesBefore) {
+    std::vector<std::pair<std::string, std::string>> entriesAfter;
+
+    if (!adb->readAllEntries(entriesAfter)) {
+        throw std::runtime_error("Failed to read back all entries from the database");
+    }
+
+    // Both lists are in key order, so merge them:
+    auto before = entriesBefore.begin();
+    auto after = entriesAfter.begin();
 
-        if (printable) {
-            std::cout << trimADBKeyPrefix(pair.first) << " = " << pair.second << std::endl;
+    while (before != entriesBefore.end() || after != entriesAfter.end()) {
+        if (after == entriesAfter.end() || (before != entriesBefore.end() && before->first < after->first)) {
+            if (before->first[0] == ADB_KEY_PREFIX[0]) {
+                std::cout << "- " << formatEntry(before->first, before->second) << std::endl;
+            }
+            ++before;
+        } else if (before == entriesBefore.end() || after->first < before->first) {
+            if (after->first[0] == ADB_KEY_PREFIX[0]) {
+                std::cout << "+ " << formatEntry(after->first, after->second) << std::endl;
+            }
+            ++after;
         } else {
-            std::cout << trimADBKeyPrefix(pair.first) << " (hex) = " << binStringToHex(pair.second) << std::endl;
+            if (before->second != after->second && after->first[0] == ADB_KEY_PREFIX[0]) {
+                std::cout << "- " << formatEntry(before->first, before->second) << std::endl;
+                std::cout << "+ " << formatEntry(after->first, after->second) << std::endl;
+            }
+            ++before;
+            ++after;
         }
     }
+
+    std::cerr << "Dry run, no changes were written to the database" << std::endl;
 }
 
 void commandListKeys(ADB *adb) {
@@ -138,8 +185,12 @@ void commandListKeys(ADB *adb) {
     }
 }
 
-std::string commandReadKey(ADB *adb, const std::string &key, ValueFormat format) {
-    std::string result(adb->readKey(ADB_KEY_PREFIX + key));
+/**
+ * @param snapshotPath - snapshot file to read the key from instead of the database (optional)
+ */
+std::string commandReadKey(ADB *adb, const std::string &key, ValueFormat format, const std::string &snapshotPath) {
+    std::string result(snapshotPath.empty() ? adb->readKey(ADB_KEY_PREFIX + key)
+        : readSnapshotKey(*adb, snapshotPath, ADB_KEY_PREFIX + key));
 
     switch (format) {
         case VF_RAW:
@@ -167,6 +218,213 @@ void commandDeleteKey(ADB *adb, const std::string &key) {
     adb->deleteKey(ADB_KEY_PREFIX + key);
 }
 
+uintmax_t getDirectorySize(const boost::filesystem::path &path) {
+    uintmax_t result = 0;
+
+    for (auto &entry : boost::filesystem::directory_iterator(path)) {
+        if (boost::filesystem::is_regular_file(entry.status())) {
+            result += boost::filesystem::file_size(entry.path());
+        }
+    }
+
+    return result;
+}
+
+void commandCompact(ADB *adb, const boost::filesystem::path &adbPath) {
+    uintmax_t sizeBefore = getDirectorySize(adbPath);
+
+    adb->compact([](size_t done, size_t total) {
+        std::cerr << "Compacted range " << done << "/" << total << std::endl;
+    });
+
+    std::cerr << "Database size went from " << sizeBefore << " to " << getDirectorySize(adbPath) << " bytes" << std::endl;
+}
+
+void commandExport(ADB *adb, const std::string &path, bool obfuscated, const std::string &compression) {
+    SnapshotCompression snapshotCompression;
+
+    if (compression == "zlib") {
+        snapshotCompression = SC_ZLIB;
+    } else if (compression == "none") {
+        snapshotCompression = SC_NONE;
+    } else {
+        throw std::runtime_error("Unsupported compression '" + compression + "'");
+    }
+
+    size_t count = exportSnapshot(*adb, path, obfuscated, snapshotCompression);
+
+    std::cerr << "Exported " << count << " entries" << std::endl;
+}
+
+void commandImport(ADB *adb, const std::string &path, bool deleteMissing) {
+    SnapshotImportResult result = importSnapshot(*adb, path, deleteMissing);
+
+    std::cerr << "Imported " << result.entries << " entries";
+
+    if (deleteMissing) {
+        std::cerr << " (deleted " << result.deleted << " keys not in the snapshot)";
+    }
+
+    std::cerr << std::endl;
+}
+
+void commandArchive(ADB *adb, const std::string &archivePath, const std::string &snapshotName, bool replace) {
+    ArchiveIngestResult result = archiveIngest(*adb, archivePath, snapshotName, replace);
+
+    std::cerr << "Archived " << result.entries << " entries (" << result.newValues << " new values)" << std::endl;
+}
+
+void commandArchiveRestore(ADB *adb, const std::string &archivePath, const std::string &snapshotName,
+        bool deleteMissing) {
+    ArchiveRestoreResult result = archiveRestore(*adb, archivePath, snapshotName, deleteMissing);
+
+    std::cerr << "Restored " << result.entries << " entries";
+
+    if (deleteMissing) {
+        std::cerr << " (deleted " << result.deleted << " keys not in the snapshot)";
+    }
+
+    std::cerr << std::endl;
+}
+
+void commandRekey(ADB *adb, const std::string &macOSSerial, const std::string &linuxSerial) {
+    size_t count = adb->rekey(ADB::makeObfuscationKey(macOSSerial, linuxSerial));
+
+    std::cerr << "Re-encrypted " << count << " entries" << std::endl;
+}
+
+void commandUndo(ADB *adb, bool all) {
+    size_t count = adb->undo(all);
+
+    std::cerr << "Undid changes to " << count << " key(s)" << std::endl;
+}
+
+void commandClone(const boost::filesystem::path &adbPath, const std::string &clonePath) {
+    CloneResult result = cloneDatabase(adbPath.string(), clonePath);
+
+    std::cerr << "Cloned database to " << clonePath << " (" << result.linkedFiles << " tables linked, "
+        << result.copiedFiles << " files copied";
+
+    if (result.attempts > 1) {
+        std::cerr << ", after " << result.attempts << " attempts";
+    }
+
+    std::cerr << ")" << std::endl;
+}
+
+int runCommand(ADB *adb, const po::variables_map &vm, const boost::filesystem::path &adbPath) {
+    if (vm["command"].as<std::string>() == "list") {
+        commandListEntries(adb);
+
+        return EXIT_SUCCESS;
+    }
+
+    if (vm["command"].as<std::string>() == "list-keys") {
+        commandListKeys(adb);
+
+        return EXIT_SUCCESS;
+    }
+
+    if (vm["command"].as<std::string>() == "read" && vm.count("key") > 0) {
+        std::string value = commandReadKey(adb, vm["key"].as<std::string>(), vm["format"].as<ValueFormat>(),
+            vm.count("snapshot-file") ? vm["snapshot-file"].as<std::string>() : "");
+
+        if (vm.count("value-file") > 0) {
+            boost::filesystem::save_string_file(vm["value-file"].as<std::string>(), value);
+        } else {
+            std::cout << value;
+        }
+        
+        return EXIT_SUCCESS;
+    }
+
+    if (vm["command"].as<std::string>() == "write" && vm.count("key") > 0) {
+        std::string value;
+
+        if (vm.count("value") > 0) {
+            value = vm["value"].as<std::string>();
+        } else if (vm.count("value-file") > 0) {
+            boost::filesystem::load_string_file(vm["value-file"].as<std::string>(), value);
+        } else {
+            // Read from stdin
+            std::ostringstream ss;
+            ss << std::cin.rdbuf();
+
+            value = ss.str();
+        }
+
+        commandWriteKey(adb, vm["key"].as<std::string>(), value, vm["format"].as<ValueFormat>());
+
+        return EXIT_SUCCESS;
+    }
+
+    if (vm["command"].as<std::string>() == "delete" && vm.count("key") > 0) {
+        commandDeleteKey(adb, vm["key"].as<std::string>());
+
+        return EXIT_SUCCESS;
+    }
+
+    if (vm["command"].as<std::string>() == "export" && vm.count("snapshot-file") > 0) {
+        commandExport(adb, vm["snapshot-file"].as<std::string>(), vm.count("obfuscated") > 0, 
+            vm["compression"].as<std::string>());
+
+        return EXIT_SUCCESS;
+    }
+
+    if (vm["command"].as<std::string>() == "import" && vm.count("snapshot-file") > 0) {
+        commandImport(adb, vm["snapshot-file"].as<std::string>(), vm.count("delete-missing") > 0);
+
+        return EXIT_SUCCESS;
+    }
+
+    if (vm["command"].as<std::string>() == "archive" && vm.count("archive-path") > 0 && vm.count("snapshot-name") > 0) {
+        commandArchive(adb, vm["archive-path"].as<std::string>(), vm["snapshot-name"].as<std::string>(),
+            vm.count("replace-snapshot") > 0);
+
+        return EXIT_SUCCESS;
+    }
+
+    if (vm["command"].as<std::string>() == "archive-restore" && vm.count("archive-path") > 0 
+            && vm.count("snapshot-name") > 0) {
+        commandArchiveRestore(adb, vm["archive-path"].as<std::string>(), vm["snapshot-name"].as<std::string>(),
+            vm.count("delete-missing") > 0);
+
+        return EXIT_SUCCESS;
+    }
+
+    if (vm["command"].as<std::string>() == "stats") {
+        writeStatsJSON(*adb, std::cout);
+
+        return EXIT_SUCCESS;
+    }
+
+    if (vm["command"].as<std::string>() == "compact") {
+        commandCompact(adb, adbPath);
+
+        return EXIT_SUCCESS;
+    }
+
+    if (vm["command"].as<std::string>() == "rekey") {
+        commandRekey(
+            adb,
+            vm.count("target-mac-serial") ? vm["target-mac-serial"].as<std::string>() : "",
+            vm.count("target-linux-serial") ? vm["target-linux-serial"].as<std::string>() : ""
+        );
+
+        return EXIT_SUCCESS;
+    }
+
+    if (vm["command"].as<std::string>() == "undo") {
+        commandUndo(adb, vm.count("all") > 0);
+
+        return EXIT_SUCCESS;
+    }
+
+    std::cerr << "Missing required arguments, use --help for syntax" << std::endl;
+
+    return EXIT_FAILURE;
+}
+
 int main(int argc, char **argv) {
     po::options_description mainOptions("Options");
     mainOptions.add_options()
@@ -179,6 +437,15 @@ int main(int argc, char **argv) {
             "serial number of the Mac that matches the adb directory (for CrashPlan Small Business, optional)")
         ("linux-serial", po::value<std::string>(),
             "serial number of the Linux machine that matches the adb directory (for CrashPlan Small Business, optional)")
+        ("cache-size", po::value<size_t>(), "size of the block cache in MB (optional)")
+        ("max-open-files", po::value<int>(), "maximum number of table files to keep open at once (optional)")
+        ("fill-cache", "let full scans of the database fill the block cache")
+        ("bloom-bits", po::value<int>(), "bits per key for bloom filters in rewritten tables, e.g. 10 (optional)")
+        ("dry-run", "apply changes to an in-memory copy of the database and print what would change, instead of writing them")
+        ("if-changed", "skip writing values which are the same as the ones already in the database (and deleting missing keys)")
+        ("no-journal", "don't record changes in the undo journal (e.g. for rekeys or large imports you won't want to undo)")
+        ("prefetch", "read all tables up front in large reads (for databases on slow network storage)")
+        ("prefetch-threads", po::value<size_t>()->default_value(8), "number of tables to prefetch at once")
         ;
 
     po::options_description readWriteOptions("Read/write command options");
@@ -189,6 +456,39 @@ int main(int argc, char **argv) {
         ("format", po::value<ValueFormat>()->default_value(ValueFormat::VF_RAW), "encoding for read/write values ('raw', 'hex')")
         ;
 
+    po::options_description rekeyOptions("Rekey command options");
+    rekeyOptions.add_options()
+        ("target-mac-serial", po::value<std::string>(),
+            "serial number of the Mac to re-encrypt the database for (omit both target serials to use the static key)")
+        ("target-linux-serial", po::value<std::string>(),
+            "serial number of the Linux machine to re-encrypt the database for")
+        ;
+
+    po::options_description snapshotOptions("Export/import command options");
+    snapshotOptions.add_options()
+        ("snapshot-file", po::value<std::string>(), "snapshot file to export to or import from (required), or to read a key from")
+        ("obfuscated", "export values still encrypted (they can only be imported into a database with the same key)")
+        ("compression", po::value<std::string>()->default_value("zlib"), "compression for exported snapshots ('zlib', 'none')")
+        ("delete-missing", "when importing or restoring, also delete keys which aren't in the snapshot (otherwise the snapshot is merged in)")
+        ;
+
+    po::options_description archiveOptions("Archive command options");
+    archiveOptions.add_options()
+        ("archive-path", po::value<std::string>(), "directory of the archive to store snapshots in (required)")
+        ("snapshot-name", po::value<std::string>(), "name of the snapshot within the archive, e.g. 'host1-2024-01-31' (required)")
+        ("replace-snapshot", "replace an existing snapshot with the same name in the archive")
+        ;
+
+    po::options_description cloneOptions("Clone command options");
+    cloneOptions.add_options()
+        ("clone-path", po::value<std::string>(), "new directory to create the clone of the database in (required)")
+        ;
+
+    po::options_description undoOptions("Undo command options");
+    undoOptions.add_options()
+        ("all", "undo every edit recorded in the journal, instead of just the most recent one")
+        ;
+
     po::options_description hiddenOptions("Hidden options");
     hiddenOptions.add_options()
         ("command", po::value<std::string>(), "command to run");
@@ -197,10 +497,10 @@ int main(int argc, char **argv) {
     positionalOptions.add("command", 1);
 
     po::options_description visibleOptions;
-    visibleOptions.add(mainOptions).add(readWriteOptions);
+    visibleOptions.add(mainOptions).add(readWriteOptions).add(rekeyOptions).add(snapshotOptions).add(archiveOptions).add(cloneOptions).add(undoOptions);
 
     po::options_description allOptions;
-    allOptions.add(mainOptions).add(readWriteOptions).add(hiddenOptions);
+    allOptions.add(mainOptions).add(readWriteOptions).add(rekeyOptions).add(snapshotOptions).add(archiveOptions).add(cloneOptions).add(undoOptions).add(hiddenOptions);
 
     po::variables_map vm;
 
@@ -223,6 +523,29 @@ int main(int argc, char **argv) {
         std::cout << "  delete    - Delete a key" << std::endl;
         std::cout << "  list      - List all keys and values in the database" << std::endl;
         std::cout << "  list-keys - List all keys in the database" << std::endl;
+        std::cout << "  export    - Save all keys and values in the database to a snapshot file" << std::endl;
+        std::cout << "  import    - Write all keys and values from a snapshot file into the database" << std::endl;
+        std::cout << "  archive   - Add a snapshot of the database to a deduplicating archive" << std::endl;
+        std::cout << "  archive-restore - Write all keys and values from an archived snapshot into the database" << std::endl;
+        std::cout << "  stats     - Report what is using space in the database, as JSON" << std::endl;
+        std::cout << "  clone     - Quickly copy the database (even while CrashPlan is running) to work on the copy" << std::endl;
+        std::cout << "  compact   - Rewrite the database's tables to reclaim space" << std::endl;
+        std::cout << "  rekey     - Re-encrypt the whole database for a different machine's serial" << std::endl;
+        std::cout << "  undo      - Roll back the most recent change made by c42-adbtool" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const std::string &command = vm["command"].as<std::string>();
+
+    // These write files outside the database, which a dry run can't keep in memory
+    if (vm.count("dry-run") && (command == "clone" || command == "archive" || command == "export")) {
+        std::cerr << "--dry-run can't be used with the " << command << " command, since it writes outside the database" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Compacting only changes how the database is stored on disk, so there's nothing for a dry run to show
+    if (vm.count("dry-run") && command == "compact") {
+        std::cerr << "--dry-run can't be used with the compact command, since it doesn't change any values" << std::endl;
         return EXIT_FAILURE;
     }
 
@@ -247,14 +570,50 @@ int main(int argc, char **argv) {
         std::cerr << "Couldn't find your ADB path automatically, supply a --path option instead" << std::endl;
         return EXIT_FAILURE;
     }
+
+    // Cloning doesn't open the database, so it works even while CrashPlan holds the lock
+    if (vm["command"].as<std::string>() == "clone") {
+        if (!vm.count("clone-path")) {
+            std::cerr << "Missing required arguments, use --help for syntax" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        try {
+            commandClone(adbPath, vm["clone-path"].as<std::string>());
+        } catch (std::exception &e) {
+            std::cerr << "Failed to clone " << adbPath.string() << ": " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+    }
     
+    ADBOptions adbOptions;
+
+    if (vm.count("cache-size")) {
+        adbOptions.blockCacheSize = vm["cache-size"].as<size_t>() * 1024 * 1024;
+    }
+    if (vm.count("max-open-files")) {
+        adbOptions.maxOpenFiles = vm["max-open-files"].as<int>();
+    }
+    adbOptions.fillCacheOnScan = vm.count("fill-cache") > 0;
+    if (vm.count("bloom-bits")) {
+        adbOptions.bloomFilterBitsPerKey = vm["bloom-bits"].as<int>();
+    }
+    adbOptions.inMemory = vm.count("dry-run") > 0;
+    adbOptions.skipUnchangedWrites = vm.count("if-changed") > 0;
+    adbOptions.undoJournal = vm.count("no-journal") == 0;
+    adbOptions.prefetchTables = vm.count("prefetch") > 0;
+    adbOptions.prefetchThreads = vm["prefetch-threads"].as<size_t>();
+
     ADB *adb;
     
     try {
         adb = new ADB(
             adbPath.string(), 
             vm.count("mac-serial") ? vm["mac-serial"].as<std::string>() : "",
-            vm.count("linux-serial") ? vm["linux-serial"].as<std::string>() : ""
+            vm.count("linux-serial") ? vm["linux-serial"].as<std::string>() : "",
+            adbOptions
         );
     } catch (std::runtime_error &e) {
         std::cerr << "Failed to open ADB database (" + adbPath.string() + "):" << std::endl;
@@ -273,69 +632,30 @@ int main(int argc, char **argv) {
         return EXIT_FAILURE;
     }
 
-    if (vm["command"].as<std::string>() == "list") {
-        commandListEntries(adb);
-
-        delete adb;
-
-        return EXIT_SUCCESS;
-    }
-
-    if (vm["command"].as<std::string>() == "list-keys") {
-        commandListKeys(adb);
+    int result;
 
-        delete adb;
-
-        return EXIT_SUCCESS;
-    }
-
-    if (vm["command"].as<std::string>() == "read" && vm.count("key") > 0) {
-        std::string value = commandReadKey(adb, vm["key"].as<std::string>(), vm["format"].as<ValueFormat>());
+    try {
+        std::vector<std::pair<std::string, std::string>> entriesBefore;
 
-        if (vm.count("value-file") > 0) {
-            boost::filesystem::save_string_file(vm["value-file"].as<std::string>(), value);
-        } else {
-            std::cout << value;
+        if (adbOptions.inMemory) {
+            adb->readAllEntries(entriesBefore);
         }
-        
-        delete adb;
-
-        return EXIT_SUCCESS;
-    }
 
-    if (vm["command"].as<std::string>() == "write" && vm.count("key") > 0) {
-        std::string value;
+        result = runCommand(adb, vm, adbPath);
 
-        if (vm.count("value") > 0) {
-            value = vm["value"].as<std::string>();
-        } else if (vm.count("value-file") > 0) {
-            boost::filesystem::load_string_file(vm["value-file"].as<std::string>(), value);
-        } else {
-            // Read from stdin
-            std::ostringstream ss;
-            ss << std::cin.rdbuf();
-
-            value = ss.str();
+        if (adbOptions.skipUnchangedWrites && result == EXIT_SUCCESS) {
+            std::cerr << "Skipped " << adb->getSkippedWriteCount() << " unchanged write(s)" << std::endl;
         }
 
-        commandWriteKey(adb, vm["key"].as<std::string>(), value, vm["format"].as<ValueFormat>());
-
-        delete adb;
-
-        return EXIT_SUCCESS;
-    }
-
-    if (vm["command"].as<std::string>() == "delete" && vm.count("key") > 0) {
-        commandDeleteKey(adb, vm["key"].as<std::string>());
-
-        delete adb;
-
-        return EXIT_SUCCESS;
+        if (adbOptions.inMemory && result == EXIT_SUCCESS) {
+            printDryRunDiff(adb, entriesBefore);
+        }
+    } catch (std::exception &e) {
+        std::cerr << "Failed to " << command << ": " << e.what() << std::endl;
+        result = EXIT_FAILURE;
     }
 
-    std::cerr << "Missing required arguments, use --help for syntax" << std::endl;
-
     delete adb;
 
-    return EXIT_FAILURE;
+    return result;
 }
\ No newline at end of file
@@ -0,0 +1,224 @@
+#include <cstdlib>
+#include <cstring>
+
+#include "c42adb.h"
+#include "adb.h"
+
+struct c42adb_t {
+    ADB *adb;
+};
+
+struct c42adb_batch_t {
+    ADBBatch batch;
+};
+
+struct c42adb_iterator_t {
+    std::unique_ptr<ADBIterator> it;
+    std::string value;
+};
+
+static char *copyString(const std::string &value) {
+    char *result = (char *) malloc(value.length() + 1);
+
+    memcpy(result, value.data(), value.length());
+    result[value.length()] = '\0';
+
+    return result;
+}
+
+static c42adb_status saveError(c42adb_status status, const char *message, char **errptr) {
+    if (errptr) {
+        *errptr = copyString(message);
+    }
+
+    return status;
+}
+
+/**
+ * Run the given operation, translating any exception it throws into a status code.
+ */
+template <typename F>
+static c42adb_status guard(char **errptr, F operation) {
+    try {
+        operation();
+
+        return C42ADB_OK;
+    } catch (ADBKeyNotFoundException &e) {
+        return saveError(C42ADB_NOT_FOUND, e.what(), errptr);
+    } catch (std::exception &e) {
+        return saveError(C42ADB_ERROR, e.what(), errptr);
+    } catch (...) {
+        return saveError(C42ADB_ERROR, "Unknown error", errptr);
+    }
+}
+
+void c42adb_options_init(c42adb_options *options) {
+    ADBOptions defaults;
+
+    options->blockCacheSize = defaults.blockCacheSize;
+    options->maxOpenFiles = defaults.maxOpenFiles;
+    options->fillCacheOnScan = defaults.fillCacheOnScan;
+    options->bloomFilterBitsPerKey = defaults.bloomFilterBitsPerKey;
+    options->undoJournal = defaults.undoJournal;
+    options->skipUnchangedWrites = defaults.skipUnchangedWrites;
+}
+
+c42adb_status c42adb_open(const char *path, const char *macSerial, const char *linuxSerial, c42adb_t **result,
+        char **errptr) {
+    c42adb_options options;
+
+    c42adb_options_init(&options);
+
+    return c42adb_open_with_options(path, macSerial, linuxSerial, &options, result, errptr);
+}
+
+c42adb_status c42adb_open_with_options(const char *path, const char *macSerial, const char *linuxSerial,
+        const c42adb_options *options, c42adb_t **result, char **errptr) {
+    if (!path || !options || !result) {
+        return saveError(C42ADB_INVALID_ARGUMENT, "Path, options and result are required", errptr);
+    }
+
+    ADBOptions adbOptions;
+
+    adbOptions.blockCacheSize = options->blockCacheSize;
+    adbOptions.maxOpenFiles = options->maxOpenFiles;
+    adbOptions.fillCacheOnScan = options->fillCacheOnScan != 0;
+    adbOptions.bloomFilterBitsPerKey = options->bloomFilterBitsPerKey;
+    adbOptions.undoJournal = options->undoJournal != 0;
+    adbOptions.skipUnchangedWrites = options->skipUnchangedWrites != 0;
+
+    return guard(errptr, [&]() {
+        *result = new c42adb_t{new ADB(path, macSerial ? macSerial : "", linuxSerial ? linuxSerial : "", adbOptions)};
+    });
+}
+
+void c42adb_close(c42adb_t *db) {
+    if (db) {
+        delete db->adb;
+        delete db;
+    }
+}
+
+c42adb_status c42adb_read(c42adb_t *db, const char *key, size_t keyLength, char **value, size_t *valueLength,
+        char **errptr) {
+    if (!db || !value || !valueLength) {
+        return saveError(C42ADB_INVALID_ARGUMENT, "Database, value and valueLength are required", errptr);
+    }
+
+    return guard(errptr, [&]() {
+        std::string result = db->adb->readKey(leveldb::Slice(key, keyLength));
+
+        *valueLength = result.length();
+        *value = copyString(result);
+    });
+}
+
+c42adb_status c42adb_write(c42adb_t *db, const char *key, size_t keyLength, const char *value, size_t valueLength,
+        char **errptr) {
+    if (!db) {
+        return saveError(C42ADB_INVALID_ARGUMENT, "Database is required", errptr);
+    }
+
+    return guard(errptr, [&]() {
+        db->adb->writeKey(leveldb::Slice(key, keyLength), leveldb::Slice(value, valueLength));
+    });
+}
+
+c42adb_status c42adb_delete(c42adb_t *db, const char *key, size_t keyLength, char **errptr) {
+    if (!db) {
+        return saveError(C42ADB_INVALID_ARGUMENT, "Database is required", errptr);
+    }
+
+    return guard(errptr, [&]() {
+        db->adb->deleteKey(leveldb::Slice(key, keyLength));
+    });
+}
+
+c42adb_batch_t *c42adb_batch_create(void) {
+    return new c42adb_batch_t;
+}
+
+void c42adb_batch_destroy(c42adb_batch_t *batch) {
+    delete batch;
+}
+
+void c42adb_batch_put(c42adb_batch_t *batch, const char *key, size_t keyLength, const char *value, size_t valueLength) {
+    batch->batch.put(leveldb::Slice(key, keyLength), leveldb::Slice(value, valueLength));
+}
+
+void c42adb_batch_delete(c42adb_batch_t *batch, const char *key, size_t keyLength) {
+    batch->batch.remove(leveldb::Slice(key, keyLength));
+}
+
+void c42adb_batch_clear(c42adb_batch_t *batch) {
+    batch->batch.clear();
+}
+
+c42adb_status c42adb_apply(c42adb_t *db, const c42adb_batch_t *batch, char **errptr) {
+    if (!db || !batch) {
+        return saveError(C42ADB_INVALID_ARGUMENT, "Database and batch are required", errptr);
+    }
+
+    return guard(errptr, [&]() {
+        db->adb->apply(batch->batch);
+    });
+}
+
+c42adb_iterator_t *c42adb_iterator_create(c42adb_t *db) {
+    return new c42adb_iterator_t{db->adb->newIterator(), ""};
+}
+
+void c42adb_iterator_destroy(c42adb_iterator_t *it) {
+    delete it;
+}
+
+void c42adb_iterator_seek_to_first(c42adb_iterator_t *it) {
+    it->it->seekToFirst();
+}
+
+void c42adb_iterator_seek(c42adb_iterator_t *it, const char *key, size_t keyLength) {
+    it->it->seek(leveldb::Slice(key, keyLength));
+}
+
+void c42adb_iterator_next(c42adb_iterator_t *it) {
+    it->it->next();
+}
+
+int c42adb_iterator_valid(const c42adb_iterator_t *it) {
+    return it->it->valid() ? 1 : 0;
+}
+
+const char *c42adb_iterator_key(const c42adb_iterator_t *it, size_t *keyLength) {
+    leveldb::Slice key = it->it->key();
+
+    *keyLength = key.size();
+
+    return key.data();
+}
+
+c42adb_status c42adb_iterator_value(c42adb_iterator_t *it, const char **value, size_t *valueLength, char **errptr) {
+    if (!value || !valueLength) {
+        return saveError(C42ADB_INVALID_ARGUMENT, "Value and valueLength are required", errptr);
+    }
+
+    return guard(errptr, [&]() {
+        it->value = it->it->value();
+
+        *value = it->value.data();
+        *valueLength = it->value.length();
+    });
+}
+
+c42adb_status c42adb_iterator_status(const c42adb_iterator_t *it, char **errptr) {
+    leveldb::Status status = it->it->status();
+
+    if (status.ok()) {
+        return C42ADB_OK;
+    }
+
+    return saveError(status.IsNotFound() ? C42ADB_NOT_FOUND : C42ADB_ERROR, status.ToString().c_str(), errptr);
+}
+
+void c42adb_free(void *ptr) {
+    free(ptr);
+}
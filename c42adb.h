@@ -0,0 +1,276 @@
+#pragma once
+
+/*
+ * Embeddable interface to CrashPlan adb/udb databases (libc42adb).
+ *
+ * Unlike the ADB class this API never throws, every call reports failure through its return code, and an optional
+ * human-readable message through errptr. Strings returned through errptr or c42adb_read() must be released with
+ * c42adb_free().
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct c42adb_t c42adb_t;
+typedef struct c42adb_iterator_t c42adb_iterator_t;
+typedef struct c42adb_batch_t c42adb_batch_t;
+
+typedef enum {
+    C42ADB_OK = 0,
+    C42ADB_NOT_FOUND = 1,
+    C42ADB_INVALID_ARGUMENT = 2,
+    C42ADB_ERROR = 3
+} c42adb_status;
+
+/* Tuning options for c42adb_open_with_options(), see ADBOptions in adb.h for details */
+typedef struct {
+    size_t blockCacheSize;     /* bytes, or 0 for LevelDB's default */
+    int maxOpenFiles;          /* or 0 for LevelDB's default */
+    int fillCacheOnScan;       /* let iterators fill the block cache */
+    int bloomFilterBitsPerKey; /* or 0 for no bloom filter */
+    int undoJournal;           /* record previous values in an undo journal next to the database */
+    int skipUnchangedWrites;   /* skip writes which wouldn't change a key's plaintext value */
+} c42adb_options;
+
+/* Fill in the defaults used by c42adb_open() */
+void c42adb_options_init(c42adb_options *options);
+
+/* Serials are optional (pass NULL), see the Readme for the key each platform uses */
+c42adb_status c42adb_open(const char *path, const char *macSerial, const char *linuxSerial, c42adb_t **result,
+    char **errptr);
+c42adb_status c42adb_open_with_options(const char *path, const char *macSerial, const char *linuxSerial,
+    const c42adb_options *options, c42adb_t **result, char **errptr);
+void c42adb_close(c42adb_t *db);
+
+/* Keys are raw database keys, so include the ADB_KEY_PREFIX byte ("\x01") */
+c42adb_status c42adb_read(c42adb_t *db, const char *key, size_t keyLength, char **value, size_t *valueLength,
+    char **errptr);
+c42adb_status c42adb_write(c42adb_t *db, const char *key, size_t keyLength, const char *value, size_t valueLength,
+    char **errptr);
+c42adb_status c42adb_delete(c42adb_t *db, const char *key, size_t keyLength, char **errptr);
+
+c42adb_batch_t *c42adb_batch_create(void);
+void c42adb_batch_destroy(c42adb_batch_t *batch);
+void c42adb_batch_put(c42adb_batch_t *batch, const char *key, size_t keyLength, const char *value, size_t valueLength);
+void c42adb_batch_delete(c42adb_batch_t *batch, const char *key, size_t keyLength);
+void c42adb_batch_clear(c42adb_batch_t *batch);
+c42adb_status c42adb_apply(c42adb_t *db, const c42adb_batch_t *batch, char **errptr);
+
+/* The key and value pointers returned by an iterator remain valid until it is next moved or destroyed */
+c42adb_iterator_t *c42adb_iterator_create(c42adb_t *db);
+void c42adb_iterator_destroy(c42adb_iterator_t *it);
+void c42adb_iterator_seek_to_first(c42adb_iterator_t *it);
+void c42adb_iterator_seek(c42adb_iterator_t *it, const char *key, size_t keyLength);
+void c42adb_iterator_next(c42adb_iterator_t *it);
+int c42adb_iterator_valid(const c42adb_iterator_t *it);
+const char *c42adb_iterator_key(const c42adb_iterator_t *it, size_t *keyLength);
+c42adb_status c42adb_iterator_value(c42adb_iterator_t *it, const char **value, size_t *valueLength, char **errptr);
+c42adb_status c42adb_iterator_status(const c42adb_iterator_t *it, char **errptr);
+
+void c42adb_free(void *ptr);
+
+#ifdef __cplusplus
+}
+
+#include <memory>
+#include <string>
+
+#include "leveldb/slice.h"
+
+namespace c42adb {
+
+/**
+ * RAII wrappers around the C interface, for C++ callers that would rather not deal with exceptions.
+ */
+
+inline void takeError(char *error, std::string *message) {
+    if (error) {
+        if (message) {
+            *message = error;
+        }
+        c42adb_free(error);
+    }
+}
+
+class Batch {
+private:
+    c42adb_batch_t *batch;
+
+public:
+    Batch() : batch(c42adb_batch_create()) {
+    }
+
+    Batch(const Batch &) = delete;
+    Batch &operator=(const Batch &) = delete;
+
+    ~Batch() {
+        c42adb_batch_destroy(batch);
+    }
+
+    void put(const leveldb::Slice &key, const leveldb::Slice &value) {
+        c42adb_batch_put(batch, key.data(), key.size(), value.data(), value.size());
+    }
+
+    void remove(const leveldb::Slice &key) {
+        c42adb_batch_delete(batch, key.data(), key.size());
+    }
+
+    void clear() {
+        c42adb_batch_clear(batch);
+    }
+
+    const c42adb_batch_t *handle() const {
+        return batch;
+    }
+};
+
+class Iterator {
+private:
+    c42adb_iterator_t *it;
+
+public:
+    explicit Iterator(c42adb_iterator_t *it) : it(it) {
+    }
+
+    Iterator(const Iterator &) = delete;
+    Iterator &operator=(const Iterator &) = delete;
+
+    ~Iterator() {
+        c42adb_iterator_destroy(it);
+    }
+
+    void seekToFirst() {
+        c42adb_iterator_seek_to_first(it);
+    }
+
+    void seek(const leveldb::Slice &target) {
+        c42adb_iterator_seek(it, target.data(), target.size());
+    }
+
+    void next() {
+        c42adb_iterator_next(it);
+    }
+
+    bool valid() const {
+        return c42adb_iterator_valid(it) != 0;
+    }
+
+    leveldb::Slice key() const {
+        size_t length;
+        const char *data = c42adb_iterator_key(it, &length);
+
+        return leveldb::Slice(data, length);
+    }
+
+    c42adb_status value(leveldb::Slice *value, std::string *error = nullptr) {
+        const char *data;
+        size_t length;
+        char *message = nullptr;
+        c42adb_status status = c42adb_iterator_value(it, &data, &length, &message);
+
+        if (status == C42ADB_OK) {
+            *value = leveldb::Slice(data, length);
+        }
+
+        takeError(message, error);
+
+        return status;
+    }
+
+    c42adb_status status(std::string *error = nullptr) const {
+        char *message = nullptr;
+        c42adb_status status = c42adb_iterator_status(it, &message);
+
+        takeError(message, error);
+
+        return status;
+    }
+};
+
+class Database {
+private:
+    c42adb_t *db;
+
+    explicit Database(c42adb_t *db) : db(db) {
+    }
+
+    static c42adb_status finish(c42adb_status status, char *message, std::string *error) {
+        takeError(message, error);
+
+        return status;
+    }
+
+public:
+    Database(const Database &) = delete;
+    Database &operator=(const Database &) = delete;
+
+    ~Database() {
+        c42adb_close(db);
+    }
+
+    static c42adb_status open(const std::string &path, const std::string &macSerial, const std::string &linuxSerial,
+            std::unique_ptr<Database> *result, std::string *error = nullptr) {
+        c42adb_options options;
+
+        c42adb_options_init(&options);
+
+        return open(path, macSerial, linuxSerial, options, result, error);
+    }
+
+    static c42adb_status open(const std::string &path, const std::string &macSerial, const std::string &linuxSerial,
+            const c42adb_options &options, std::unique_ptr<Database> *result, std::string *error = nullptr) {
+        c42adb_t *handle = nullptr;
+        char *message = nullptr;
+        c42adb_status status = c42adb_open_with_options(path.c_str(), macSerial.c_str(), linuxSerial.c_str(), &options,
+            &handle, &message);
+
+        if (status == C42ADB_OK) {
+            result->reset(new Database(handle));
+        }
+
+        return finish(status, message, error);
+    }
+
+    c42adb_status read(const leveldb::Slice &key, std::string *value, std::string *error = nullptr) {
+        char *data = nullptr;
+        size_t length = 0;
+        char *message = nullptr;
+        c42adb_status status = c42adb_read(db, key.data(), key.size(), &data, &length, &message);
+
+        if (status == C42ADB_OK) {
+            value->assign(data, length);
+            c42adb_free(data);
+        }
+
+        return finish(status, message, error);
+    }
+
+    c42adb_status write(const leveldb::Slice &key, const leveldb::Slice &value, std::string *error = nullptr) {
+        char *message = nullptr;
+
+        return finish(c42adb_write(db, key.data(), key.size(), value.data(), value.size(), &message), message, error);
+    }
+
+    c42adb_status remove(const leveldb::Slice &key, std::string *error = nullptr) {
+        char *message = nullptr;
+
+        return finish(c42adb_delete(db, key.data(), key.size(), &message), message, error);
+    }
+
+    c42adb_status apply(const Batch &batch, std::string *error = nullptr) {
+        char *message = nullptr;
+
+        return finish(c42adb_apply(db, batch.handle(), &message), message, error);
+    }
+
+    std::unique_ptr<Iterator> newIterator() {
+        return std::unique_ptr<Iterator>(new Iterator(c42adb_iterator_create(db)));
+    }
+};
+
+}
+
+#endif
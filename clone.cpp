@@ -0,0 +1,272 @@
+#include <cinttypes>
+#include <cstdlib>
+#include <set>
+#include <stdexcept>
+#include <utility>
+
+#include "boost/filesystem/operations.hpp"
+#include "boost/filesystem/string_file.hpp"
+
+#include "clone.h"
+#include "common.h"
+
+/*
+ * Once a table has been completely written and recorded in the MANIFEST, LevelDB never modifies it, so a clone can
+ * share those tables with the source database by hardlinking them. Only the small files that are still being appended
+ * to (CURRENT, the MANIFEST it names and the .log files) need to be copied.
+ *
+ * We must only link the tables that our copy of the MANIFEST lists. Any other table in the directory may be the output
+ * of a flush or compaction that is still being written, and its file number is one our copy of the MANIFEST considers
+ * unused. When the clone is opened, LevelDB could then create a new table with that same name, truncating and
+ * rewriting the file that is shared with the live database.
+ *
+ * This doesn't take the database's lock, so it works while CrashPlan has the database open. A compaction or memtable
+ * flush which finishes while we're cloning appends to the MANIFEST (or switches to a new one), and may delete tables
+ * or logs we were about to link, so in those cases we throw away the clone and try again.
+ */
+
+namespace fs = boost::filesystem;
+
+static const int MAX_CLONE_ATTEMPTS = 10;
+
+// Tags of the fields in a VersionEdit (see leveldb/db/version_edit.cc)
+enum VersionEditTag {
+    TAG_COMPARATOR = 1,
+    TAG_LOG_NUMBER = 2,
+    TAG_NEXT_FILE_NUMBER = 3,
+    TAG_LAST_SEQUENCE = 4,
+    TAG_COMPACT_POINTER = 5,
+    TAG_DELETED_FILE = 6,
+    TAG_NEW_FILE = 7,
+    TAG_PREV_LOG_NUMBER = 9
+};
+
+/**
+ * The parts of the database's state recorded in the MANIFEST that we need to make a clone.
+ */
+struct ManifestState {
+    std::set<std::pair<uint64_t, uint64_t>> liveTables; // (level, file number)
+    uint64_t logNumber = 0;
+    uint64_t prevLogNumber = 0;
+};
+
+static bool applyVersionEdit(const std::string &edit, ManifestState &state) {
+    const char *p = edit.data(), *limit = p + edit.length();
+    uint64_t tag, level, number, ignored;
+    std::string ignoredString;
+
+    while (p < limit) {
+        if (!readVarint64(p, limit, tag)) {
+            return false;
+        }
+
+        bool ok;
+
+        switch (tag) {
+            case TAG_COMPARATOR:
+                ok = readLengthPrefixed(p, limit, ignoredString);
+                break;
+            case TAG_LOG_NUMBER:
+                ok = readVarint64(p, limit, state.logNumber);
+                break;
+            case TAG_PREV_LOG_NUMBER:
+                ok = readVarint64(p, limit, state.prevLogNumber);
+                break;
+            case TAG_NEXT_FILE_NUMBER:
+            case TAG_LAST_SEQUENCE:
+                ok = readVarint64(p, limit, ignored);
+                break;
+            case TAG_COMPACT_POINTER:
+                ok = readVarint64(p, limit, level) && readLengthPrefixed(p, limit, ignoredString);
+                break;
+            case TAG_DELETED_FILE:
+                ok = readVarint64(p, limit, level) && readVarint64(p, limit, number);
+                state.liveTables.erase(std::make_pair(level, number));
+                break;
+            case TAG_NEW_FILE:
+                ok = readVarint64(p, limit, level) && readVarint64(p, limit, number) && readVarint64(p, limit, ignored)
+                    && readLengthPrefixed(p, limit, ignoredString) && readLengthPrefixed(p, limit, ignoredString);
+                state.liveTables.insert(std::make_pair(level, number));
+                break;
+            default:
+                ok = false;
+        }
+
+        if (!ok) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Replay the VersionEdits in a MANIFEST to find the tables and logs that make up the database.
+ *
+ * @return false if the MANIFEST couldn't be completely parsed (e.g. because a record was still being written to it)
+ */
+static bool readManifest(const fs::path &manifestPath, ManifestState &state) {
+    std::string contents;
+    bool valid = true;
+
+    fs::load_string_file(manifestPath, contents);
+
+    bool complete = forEachLogRecord(contents, [&](const std::string &edit) {
+        valid = valid && applyVersionEdit(edit, state);
+    });
+
+    return complete && valid;
+}
+
+/**
+ * @return the file number of a LevelDB file named like "000123.log", or 0 if the name isn't in that form
+ */
+static uint64_t getFileNumber(const std::string &name) {
+    return strtoull(name.c_str(), nullptr, 10);
+}
+
+static std::string makeFileName(uint64_t number, const char *suffix) {
+    char buffer[32];
+
+    snprintf(buffer, sizeof(buffer), "%06" PRIu64 "%s", number, suffix);
+
+    return buffer;
+}
+
+static std::string readCurrentManifest(const fs::path &sourcePath) {
+    std::string current;
+
+    fs::load_string_file(sourcePath / "CURRENT", current);
+
+    if (current.empty() || current.back() != '\n') {
+        throw std::runtime_error("Failed to read CURRENT in " + sourcePath.string());
+    }
+
+    return current.substr(0, current.length() - 1);
+}
+
+/**
+ * @return false if the source file vanished before it could be copied
+ */
+static bool copyFile(const fs::path &from, const fs::path &to) {
+    boost::system::error_code error;
+
+    fs::copy_file(from, to, error);
+
+    if (!error) {
+        return true;
+    }
+
+    if (!fs::exists(from)) {
+        return false;
+    }
+
+    throw fs::filesystem_error("Failed to copy file", from, to, error);
+}
+
+/**
+ * Hardlink the file if possible, falling back to a copy (e.g. if the clone is on a different filesystem).
+ *
+ * @return false if the source file vanished before it could be linked
+ */
+static bool linkFile(const fs::path &from, const fs::path &to, bool &linked) {
+    boost::system::error_code error;
+
+    fs::create_hard_link(from, to, error);
+    linked = !error;
+
+    return linked || copyFile(from, to);
+}
+
+/**
+ * @return false if the source database changed underneath us, so the clone may be inconsistent
+ */
+static bool tryClone(const fs::path &sourcePath, const fs::path &clonePath, CloneResult &result) {
+    std::string manifest = readCurrentManifest(sourcePath);
+
+    fs::create_directories(clonePath);
+
+    // Every later change to the database's set of tables and logs is appended to this, so we can detect them by its size
+    if (!copyFile(sourcePath / manifest, clonePath / manifest)) {
+        return false;
+    }
+
+    uintmax_t manifestSize = fs::file_size(clonePath / manifest);
+    ManifestState state;
+
+    if (!readManifest(clonePath / manifest, state)) {
+        return false;
+    }
+
+    result.linkedFiles = 0;
+    result.copiedFiles = 1;
+
+    for (auto &table : state.liveTables) {
+        // Older databases name their tables .sst rather than .ldb
+        std::string name = makeFileName(table.second, ".ldb");
+
+        if (!fs::exists(sourcePath / name)) {
+            name = makeFileName(table.second, ".sst");
+        }
+
+        bool linked;
+
+        if (!linkFile(sourcePath / name, clonePath / name, linked)) {
+            return false;
+        }
+
+        if (linked) {
+            result.linkedFiles++;
+        } else {
+            result.copiedFiles++;
+        }
+    }
+
+    // Copy the same logs that LevelDB would replay when opening the database (see DBImpl::Recover)
+    for (auto &entry : fs::directory_iterator(sourcePath)) {
+        std::string name = entry.path().filename().string();
+        uint64_t number = getFileNumber(name);
+
+        if (hasSuffix(name, ".log") && (number >= state.logNumber || number == state.prevLogNumber)) {
+            if (!copyFile(entry.path(), clonePath / name)) {
+                return false;
+            }
+
+            result.copiedFiles++;
+        }
+    }
+
+    fs::save_string_file(clonePath / "CURRENT", manifest + "\n");
+    result.copiedFiles++;
+
+    boost::system::error_code error;
+    uintmax_t manifestSizeAfter = fs::file_size(sourcePath / manifest, error);
+
+    return !error && manifestSizeAfter == manifestSize && readCurrentManifest(sourcePath) == manifest;
+}
+
+/**
+ * Make a consistent copy of the database at sourcePath in the new directory clonePath, hardlinking its tables rather
+ * than copying them where possible. The source database may be open in another process while we do this.
+ */
+CloneResult cloneDatabase(const std::string &sourcePath, const std::string &clonePath) {
+    if (!fs::is_directory(sourcePath)) {
+        throw std::runtime_error("Database directory " + sourcePath + " does not exist");
+    }
+
+    if (fs::exists(clonePath) && !fs::is_empty(clonePath)) {
+        throw std::runtime_error("Clone directory " + clonePath + " already exists and is not empty");
+    }
+
+    CloneResult result;
+
+    for (result.attempts = 1; result.attempts <= MAX_CLONE_ATTEMPTS; result.attempts++) {
+        if (tryClone(sourcePath, clonePath, result)) {
+            return result;
+        }
+
+        fs::remove_all(clonePath);
+    }
+
+    throw std::runtime_error("Database " + sourcePath + " kept changing while it was being cloned, try again later");
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <string>
+
+struct CloneResult {
+    size_t linkedFiles;
+    size_t copiedFiles;
+    int attempts;
+};
+
+CloneResult cloneDatabase(const std::string &sourcePath, const std::string &clonePath);
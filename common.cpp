@@ -2,6 +2,22 @@
 #define _POSIX_C_SOURCE 200112L
 #define _FILE_OFFSET_BITS 64
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "zlib.h"
+
 #include "common.h"
 
 #include "cryptopp/modes.h"
@@ -66,3 +82,244 @@ std::string binStringToHex(std::string input) {
 
 	return result;
 }
+
+/**
+ * Call body(i) for every i in [0, count) using numThreads threads (or one per core if numThreads is 0). If any call
+ * throws, the remaining work is abandoned and the first exception is rethrown on the calling thread.
+ */
+void parallelFor(size_t count, const std::function<void(size_t)> &body, size_t numThreads) {
+    if (numThreads == 0) {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    numThreads = std::min(numThreads, count);
+
+    if (numThreads <= 1) {
+        for (size_t i = 0; i < count; i++) {
+            body(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    std::exception_ptr error;
+    std::mutex errorLock;
+    std::vector<std::thread> threads;
+
+    for (size_t t = 0; t < numThreads; t++) {
+        threads.emplace_back([&]() {
+            for (size_t i = next++; i < count && !failed; i = next++) {
+                try {
+                    body(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> guard(errorLock);
+
+                    if (!failed) {
+                        error = std::current_exception();
+                        failed = true;
+                    }
+                }
+            }
+        });
+    }
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+/*
+ * Little-endian integer encodings, for our own file formats.
+ */
+
+void appendFixed32(std::string &dest, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        dest.push_back((char) ((value >> (i * 8)) & 0xFF));
+    }
+}
+
+void appendFixed64(std::string &dest, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        dest.push_back((char) ((value >> (i * 8)) & 0xFF));
+    }
+}
+
+void appendVarint64(std::string &dest, uint64_t value) {
+    while (value >= 0x80) {
+        dest.push_back((char) ((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+
+    dest.push_back((char) value);
+}
+
+void appendLengthPrefixed(std::string &dest, const std::string &value) {
+    appendVarint64(dest, value.length());
+    dest.append(value);
+}
+
+uint32_t decodeFixed32(const char *p) {
+    uint32_t result = 0;
+
+    for (int i = 0; i < 4; i++) {
+        result |= ((uint32_t) (uint8_t) p[i]) << (i * 8);
+    }
+
+    return result;
+}
+
+uint64_t decodeFixed64(const char *p) {
+    uint64_t result = 0;
+
+    for (int i = 0; i < 8; i++) {
+        result |= ((uint64_t) (uint8_t) p[i]) << (i * 8);
+    }
+
+    return result;
+}
+
+/**
+ * Decode a varint from p, advancing p past it. Returns false if the input is truncated or malformed.
+ */
+bool readVarint64(const char *&p, const char *limit, uint64_t &value) {
+    value = 0;
+
+    for (int shift = 0; shift <= 63 && p < limit; shift += 7) {
+        uint8_t byte = (uint8_t) *p++;
+
+        value |= ((uint64_t) (byte & 0x7F)) << shift;
+
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool readLengthPrefixed(const char *&p, const char *limit, std::string &value) {
+    uint64_t length;
+
+    if (!readVarint64(p, limit, length) || length > (uint64_t) (limit - p)) {
+        return false;
+    }
+
+    value.assign(p, length);
+    p += length;
+
+    return true;
+}
+uint32_t crc32Of(const char *data, size_t length) {
+    return (uint32_t) crc32(crc32(0L, Z_NULL, 0), (const Bytef *) data, (uInt) length);
+}
+
+bool hasSuffix(const std::string &value, const std::string &suffix) {
+    return value.length() >= suffix.length()
+        && value.compare(value.length() - suffix.length(), suffix.length(), suffix) == 0;
+}
+
+/**
+ * Write (or append) the contents to the file, and make sure they have reached the disk before returning.
+ */
+void writeFileDurably(const std::string &path, const std::string &contents, bool append) {
+    FILE *file = fopen(path.c_str(), append ? "ab" : "wb");
+
+    if (!file) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+
+    bool success = fwrite(contents.data(), 1, contents.length(), file) == contents.length() && fflush(file) == 0;
+
+#ifdef _WIN32
+    success = success && _commit(_fileno(file)) == 0;
+#else
+    success = success && fsync(fileno(file)) == 0;
+#endif
+
+    success = fclose(file) == 0 && success;
+
+    if (!success) {
+        throw std::runtime_error("Failed to write to " + path);
+    }
+}
+
+// LevelDB log files (including the MANIFEST) are made of blocks of this size, holding records with a 7-byte header
+// (see leveldb/db/log_format.h)
+static const size_t LOG_BLOCK_SIZE = 32768;
+static const size_t LOG_HEADER_SIZE = 7;
+
+enum LogRecordType {
+    LOG_ZERO = 0,
+    LOG_FULL = 1,
+    LOG_FIRST = 2,
+    LOG_MIDDLE = 3,
+    LOG_LAST = 4
+};
+
+/**
+ * Reassemble the records of a LevelDB log file and pass each one to the callback. We stop at the first malformed
+ * record, since the tail of the log may not have been completely written.
+ *
+ * @return true if the whole file was read, false if we stopped at a malformed record
+ */
+bool forEachLogRecord(const std::string &contents, const std::function<void(const std::string &record)> &callback) {
+    std::string record;
+    size_t pos = 0;
+
+    while (pos < contents.length()) {
+        size_t blockRemaining = LOG_BLOCK_SIZE - pos % LOG_BLOCK_SIZE;
+
+        if (blockRemaining < LOG_HEADER_SIZE) {
+            // Block trailer
+            pos += blockRemaining;
+            continue;
+        }
+
+        if (contents.length() - pos < LOG_HEADER_SIZE) {
+            return false;
+        }
+
+        size_t length = (uint8_t) contents[pos + 4] | ((uint8_t) contents[pos + 5] << 8);
+        uint8_t type = (uint8_t) contents[pos + 6];
+
+        if (type == LOG_ZERO && length == 0) {
+            // Preallocated space, skip to the next block
+            pos += blockRemaining;
+            continue;
+        }
+
+        if (LOG_HEADER_SIZE + length > blockRemaining || pos + LOG_HEADER_SIZE + length > contents.length()) {
+            return false;
+        }
+
+        const char *fragment = contents.data() + pos + LOG_HEADER_SIZE;
+
+        switch (type) {
+            case LOG_FULL:
+                record.assign(fragment, length);
+                callback(record);
+                break;
+            case LOG_FIRST:
+                record.assign(fragment, length);
+                break;
+            case LOG_MIDDLE:
+                record.append(fragment, length);
+                break;
+            case LOG_LAST:
+                record.append(fragment, length);
+                callback(record);
+                break;
+            default:
+                return false;
+        }
+
+        pos += LOG_HEADER_SIZE + length;
+    }
+
+    return true;
+}
@@ -4,6 +4,27 @@
 #include <cstdint>
 #include <string>
 #include <iostream>
+#include <functional>
 
 std::string hexStringToBin(std::string input);
 std::string binStringToHex(std::string input);
+
+void parallelFor(size_t count, const std::function<void(size_t)> &body, size_t numThreads = 0);
+
+void appendFixed32(std::string &dest, uint32_t value);
+void appendFixed64(std::string &dest, uint64_t value);
+void appendVarint64(std::string &dest, uint64_t value);
+void appendLengthPrefixed(std::string &dest, const std::string &value);
+
+uint32_t decodeFixed32(const char *p);
+uint64_t decodeFixed64(const char *p);
+bool readVarint64(const char *&p, const char *limit, uint64_t &value);
+bool readLengthPrefixed(const char *&p, const char *limit, std::string &value);
+
+uint32_t crc32Of(const char *data, size_t length);
+
+bool hasSuffix(const std::string &value, const std::string &suffix);
+
+void writeFileDurably(const std::string &path, const std::string &contents, bool append);
+
+bool forEachLogRecord(const std::string &contents, const std::function<void(const std::string &record)> &callback);
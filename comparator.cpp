@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <cstdint>
+
 #include "comparator.h"
 
 const char* Code42Comparator::Name() const {
@@ -8,8 +11,42 @@ int Code42Comparator::Compare(const leveldb::Slice& a, const leveldb::Slice& b)
     return a.compare(b);
 }
 
-void Code42Comparator::FindShortestSeparator(std::string*, const leveldb::Slice&) const {
+/*
+ * Since keys are ordered bytewise, we can shorten keys for the table index the same way LevelDB's own 
+ * BytewiseComparator does. Results only need to sort between the original keys, so readers are unaffected.
+ */
+
+void Code42Comparator::FindShortestSeparator(std::string* start, const leveldb::Slice& limit) const {
+    // Find length of common prefix
+    size_t minLength = std::min(start->size(), limit.size());
+    size_t diffIndex = 0;
+
+    while (diffIndex < minLength && (*start)[diffIndex] == limit[diffIndex]) {
+        diffIndex++;
+    }
+
+    if (diffIndex >= minLength) {
+        // Do not shorten if one string is a prefix of the other
+        return;
+    }
+
+    uint8_t diffByte = (uint8_t) (*start)[diffIndex];
+
+    if (diffByte < 0xFF && diffByte + 1 < (uint8_t) limit[diffIndex]) {
+        (*start)[diffIndex]++;
+        start->resize(diffIndex + 1);
+    }
 }
 
-void Code42Comparator::FindShortSuccessor(std::string*) const {
-}
\ No newline at end of file
+void Code42Comparator::FindShortSuccessor(std::string* key) const {
+    // Find first character that can be incremented
+    for (size_t i = 0; i < key->size(); i++) {
+        if ((uint8_t) (*key)[i] != 0xFF) {
+            (*key)[i] = (char) ((uint8_t) (*key)[i] + 1);
+            key->resize(i + 1);
+            return;
+        }
+    }
+
+    // *key is a run of 0xffs. Leave it alone.
+}
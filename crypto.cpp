@@ -90,4 +90,20 @@ std::string generateSmallBusinessKeyV2(const std::string &passphrase, const std:
     );
     
     return std::string((const char *)derived, sizeof(derived));
+}
+
+std::string sha256(const std::string &data) {
+    CryptoPP::SHA256 hash;
+    CryptoPP::byte digest[CryptoPP::SHA256::DIGESTSIZE];
+
+    hash.CalculateDigest(digest, (const CryptoPP::byte *) data.data(), data.length());
+
+    return std::string((const char *) digest, sizeof(digest));
+}
+
+/**
+ * A short identifier for a key: the first 8 bytes of its SHA-256 hash.
+ */
+std::string keyFingerprint(const std::string &key) {
+    return sha256(key).substr(0, 8);
 }
\ No newline at end of file
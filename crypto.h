@@ -22,4 +22,6 @@ public:
     std::string encrypt(const std::string & plainText, const std::string & key) const override;
 };
 
-std::string generateSmallBusinessKeyV2(const std::string &passphrase, const std::string &salt);
\ No newline at end of file
+std::string generateSmallBusinessKeyV2(const std::string &passphrase, const std::string &salt);
+std::string sha256(const std::string &data);
+std::string keyFingerprint(const std::string &key);
\ No newline at end of file
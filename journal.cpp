@@ -0,0 +1,251 @@
+#include <fstream>
+#include <stdexcept>
+
+#include "boost/filesystem/operations.hpp"
+#include "boost/filesystem/string_file.hpp"
+
+#include "journal.h"
+#include "common.h"
+
+/*
+ * The journal is a sequence of records, one for each edit made to the database, with the most recent last:
+ *
+ *     fixed32 length of the payload
+ *     fixed32 crc32 of the payload
+ *     payload:
+ *         byte flags (RECORD_CONTINUES_TRANSACTION)
+ *         varint number of entries
+ *         for each entry: byte 1 if the key existed (else 0), string key, string previous value (only if it existed)
+ *     fixed32 length of the payload, again
+ *     fixed32 crc32 of the payload, again
+ *
+ * A record is written and synced before its edit is committed to the database. If we crash part-way through writing
+ * one, the torn record fails its checksum and is discarded. The copy of the header at the end of each record lets us
+ * check that the last record is complete, and walk backwards through the records, without reading the whole journal.
+ *
+ * A record flagged RECORD_CONTINUES_TRANSACTION belongs to the same transaction as the record before it, so that
+ * commands which commit several batches (like import) are undone as a whole.
+ */
+
+static const size_t RECORD_HEADER_SIZE = 8;
+static const size_t RECORD_OVERHEAD = RECORD_HEADER_SIZE * 2;
+
+static const uint8_t RECORD_CONTINUES_TRANSACTION = 1;
+
+static std::string readRange(std::ifstream &file, uint64_t offset, size_t length) {
+    std::string result(length, '\0');
+
+    file.seekg(offset);
+    file.read(&result[0], length);
+
+    if (!file || (size_t) file.gcount() != length) {
+        throw std::runtime_error("Failed to read from undo journal");
+    }
+
+    return result;
+}
+
+UndoJournal::UndoJournal(const std::string &path, uint64_t maxSize) : path(path), maxSize(maxSize) {
+}
+
+const std::string &UndoJournal::getPath() const {
+    return path;
+}
+
+/**
+ * Parse every complete transaction in the journal.
+ *
+ * @return the length of the valid part of the journal
+ */
+uint64_t UndoJournal::readTransactions(std::vector<Transaction> &transactions) const {
+    std::string contents;
+
+    if (boost::filesystem::exists(path)) {
+        boost::filesystem::load_string_file(path, contents);
+    }
+
+    const char *start = contents.data();
+    const char *limit = start + contents.length();
+    const char *p = start;
+
+    while ((size_t) (limit - p) >= RECORD_OVERHEAD) {
+        uint32_t length = decodeFixed32(p);
+        uint32_t crc = decodeFixed32(p + 4);
+
+        if ((size_t) (limit - p) - RECORD_OVERHEAD < length || length == 0
+                || crc32Of(p + RECORD_HEADER_SIZE, length) != crc
+                || decodeFixed32(p + RECORD_HEADER_SIZE + length) != length
+                || decodeFixed32(p + RECORD_HEADER_SIZE + length + 4) != crc) {
+            break;
+        }
+
+        const char *payload = p + RECORD_HEADER_SIZE;
+        const char *payloadLimit = payload + length;
+        uint8_t flags = *payload++;
+        Transaction transaction;
+        uint64_t count;
+
+        transaction.offset = p - start;
+
+        if (!readVarint64(payload, payloadLimit, count)) {
+            break;
+        }
+
+        for (uint64_t i = 0; i < count; i++) {
+            Entry entry;
+
+            if (payload >= payloadLimit) {
+                throw std::runtime_error("Corrupt undo journal " + path);
+            }
+
+            entry.existed = *payload++ != 0;
+
+            if (!readLengthPrefixed(payload, payloadLimit, entry.key)
+                    || (entry.existed && !readLengthPrefixed(payload, payloadLimit, entry.previousValue))) {
+                throw std::runtime_error("Corrupt undo journal " + path);
+            }
+
+            transaction.entries.push_back(entry);
+        }
+
+        if ((flags & RECORD_CONTINUES_TRANSACTION) && !transactions.empty()) {
+            auto &entries = transactions.back().entries;
+
+            entries.insert(entries.end(), transaction.entries.begin(), transaction.entries.end());
+        } else {
+            transactions.push_back(transaction);
+        }
+
+        p = payloadLimit + RECORD_HEADER_SIZE;
+    }
+
+    return p - start;
+}
+
+std::vector<UndoJournal::Transaction> UndoJournal::readAll() const {
+    std::vector<Transaction> result;
+
+    readTransactions(result);
+
+    return result;
+}
+
+/**
+ * Check that the journal (of the given size) ends with a complete record, by comparing the last record's header with
+ * its trailing copy. This doesn't verify the checksum, since that would mean reading the whole record.
+ */
+bool UndoJournal::tailIsValid(uint64_t size) const {
+    if (size == 0) {
+        return true;
+    }
+
+    if (size < RECORD_OVERHEAD) {
+        return false;
+    }
+
+    std::ifstream file(path, std::ios::binary);
+    std::string trailer = readRange(file, size - RECORD_HEADER_SIZE, RECORD_HEADER_SIZE);
+    uint32_t length = decodeFixed32(trailer.data());
+
+    if (length == 0 || size - RECORD_OVERHEAD < length) {
+        return false;
+    }
+
+    return readRange(file, size - RECORD_OVERHEAD - length, RECORD_HEADER_SIZE) == trailer;
+}
+
+/**
+ * Discard the oldest transactions so the journal shrinks to about keepSize bytes (but always keep the most recent
+ * transaction whole).
+ *
+ * @return the new size of the journal
+ */
+uint64_t UndoJournal::rotate(uint64_t size, uint64_t keepSize) {
+    std::ifstream file(path, std::ios::binary);
+    uint64_t cut = size;
+
+    // Walk backwards through the records, moving the cut to the start of each transaction that still fits
+    for (uint64_t end = size; end > 0; ) {
+        uint32_t length = decodeFixed32(readRange(file, end - RECORD_HEADER_SIZE, RECORD_HEADER_SIZE).data());
+        uint64_t start = end - RECORD_OVERHEAD - length;
+        uint8_t flags = readRange(file, start + RECORD_HEADER_SIZE, 1)[0];
+
+        if (!(flags & RECORD_CONTINUES_TRANSACTION)) {
+            if (size - start > keepSize && cut != size) {
+                break;
+            }
+
+            cut = start;
+        }
+
+        end = start;
+    }
+
+    if (cut == 0) {
+        return size;
+    }
+
+    std::string tail = readRange(file, cut, size - cut);
+    std::string tempPath = path + ".tmp";
+
+    file.close();
+
+    writeFileDurably(tempPath, tail, false);
+    boost::filesystem::rename(tempPath, path);
+
+    return tail.length();
+}
+
+/**
+ * Durably record a new transaction at the end of the journal, or add to the most recent transaction if
+ * continuesTransaction is true.
+ *
+ * @return the offset the record was written at, for passing to truncate() if the edit can't be committed after all
+ */
+uint64_t UndoJournal::append(const std::vector<Entry> &entries, bool continuesTransaction) {
+    uint64_t size = boost::filesystem::exists(path) ? boost::filesystem::file_size(path) : 0;
+
+    if (!tailIsValid(size)) {
+        // Discard a torn record from an earlier crash so we don't append after it. This is the only case where we
+        // need to read the whole journal.
+        std::vector<Transaction> transactions;
+
+        size = readTransactions(transactions);
+        truncate(size);
+    }
+
+    std::string payload;
+
+    payload.push_back(continuesTransaction ? RECORD_CONTINUES_TRANSACTION : 0);
+    appendVarint64(payload, entries.size());
+
+    for (auto &entry : entries) {
+        payload.push_back(entry.existed ? 1 : 0);
+        appendLengthPrefixed(payload, entry.key);
+
+        if (entry.existed) {
+            appendLengthPrefixed(payload, entry.previousValue);
+        }
+    }
+
+    if (size > 0 && size + payload.length() + RECORD_OVERHEAD > maxSize) {
+        size = rotate(size, maxSize / 2);
+    }
+
+    std::string header;
+
+    appendFixed32(header, payload.length());
+    appendFixed32(header, crc32Of(payload.data(), payload.length()));
+
+    writeFileDurably(path, header + payload + header, true);
+
+    return size;
+}
+
+void UndoJournal::truncate(uint64_t length) {
+    if (length == 0) {
+        boost::filesystem::remove(path);
+    } else {
+        boost::filesystem::resize_file(path, length);
+    }
+}
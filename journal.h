@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * An append-only journal recording the previous (still obfuscated) values of the keys touched by each edit to the
+ * database, so that edits can be rolled back. See journal.cpp for the file layout.
+ */
+class UndoJournal {
+public:
+    struct Entry {
+        std::string key;
+        bool existed;
+        std::string previousValue;
+    };
+
+    struct Transaction {
+        uint64_t offset;
+        std::vector<Entry> entries;
+    };
+
+private:
+    std::string path;
+    uint64_t maxSize;
+
+    uint64_t readTransactions(std::vector<Transaction> &transactions) const;
+    bool tailIsValid(uint64_t size) const;
+    uint64_t rotate(uint64_t size, uint64_t keepSize);
+
+public:
+    UndoJournal(const std::string &path, uint64_t maxSize);
+
+    const std::string &getPath() const;
+
+    uint64_t append(const std::vector<Entry> &entries, bool continuesTransaction);
+
+    std::vector<Transaction> readAll() const;
+    void truncate(uint64_t length);
+};
@@ -0,0 +1,237 @@
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "prefetch_env.h"
+#include "common.h"
+
+/**
+ * Serves reads of a table from a copy of the whole file held in memory.
+ */
+class MemoryRandomAccessFile : public leveldb::RandomAccessFile {
+private:
+    std::shared_ptr<const std::string> data;
+
+public:
+    explicit MemoryRandomAccessFile(std::shared_ptr<const std::string> data) : data(data) {
+    }
+
+    leveldb::Status Read(uint64_t offset, size_t n, leveldb::Slice *result, char *scratch) const override {
+        if (offset > data->length()) {
+            *result = leveldb::Slice();
+            return leveldb::Status::IOError("Read past end of file");
+        }
+
+        *result = leveldb::Slice(data->data() + offset, std::min((uint64_t) n, data->length() - offset));
+
+        return leveldb::Status::OK();
+    }
+};
+
+#ifndef _WIN32
+
+static leveldb::Status errnoToStatus(const std::string &fname) {
+    return leveldb::Status::IOError(fname, strerror(errno));
+}
+
+/**
+ * Serves reads of a table from a memory mapping, which the OS is asked to read ahead.
+ */
+class MmapRandomAccessFile : public leveldb::RandomAccessFile {
+private:
+    char *base;
+    size_t length;
+
+public:
+    MmapRandomAccessFile(char *base, size_t length) : base(base), length(length) {
+    }
+
+    ~MmapRandomAccessFile() override {
+        munmap(base, length);
+    }
+
+    leveldb::Status Read(uint64_t offset, size_t n, leveldb::Slice *result, char *scratch) const override {
+        if (offset > length) {
+            *result = leveldb::Slice();
+            return leveldb::Status::IOError("Read past end of file");
+        }
+
+        *result = leveldb::Slice(base + offset, std::min((uint64_t) n, length - offset));
+
+        return leveldb::Status::OK();
+    }
+};
+
+#endif
+
+PrefetchEnv::PrefetchEnv(leveldb::Env *target, size_t maxWholeFileSize) : leveldb::EnvWrapper(target),
+        maxWholeFileSize(maxWholeFileSize) {
+}
+
+bool PrefetchEnv::isTableFile(const std::string &fname) {
+    return hasSuffix(fname, ".ldb") || hasSuffix(fname, ".sst");
+}
+
+leveldb::Status PrefetchEnv::readWholeFile(const std::string &fname, std::string &data) {
+#ifdef _WIN32
+    return leveldb::ReadFileToString(target(), fname, &data);
+#else
+    int fd = open(fname.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+        return errnoToStatus(fname);
+    }
+
+    struct stat info;
+
+    if (fstat(fd, &info) != 0) {
+        leveldb::Status status = errnoToStatus(fname);
+        close(fd);
+        return status;
+    }
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    data.resize(info.st_size);
+
+    for (size_t done = 0; done < data.length(); ) {
+        ssize_t bytesRead = pread(fd, &data[done], data.length() - done, done);
+
+        if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (bytesRead <= 0) {
+            leveldb::Status status = bytesRead < 0 ? errnoToStatus(fname) : leveldb::Status::IOError(fname, "File truncated");
+            close(fd);
+            return status;
+        }
+
+        done += bytesRead;
+    }
+
+    close(fd);
+
+    return leveldb::Status::OK();
+#endif
+}
+
+/**
+ * Start reading every table in the database ahead of time, using numThreads threads so that the latency of many
+ * files can be overlapped. Small tables are read into memory, larger ones are just hinted to the OS.
+ */
+void PrefetchEnv::prefetch(const std::string &dbPath, size_t numThreads) {
+    std::vector<std::string> children, tables;
+
+    if (!GetChildren(dbPath, &children).ok()) {
+        return;
+    }
+
+    for (auto &child : children) {
+        if (isTableFile(child)) {
+            tables.push_back(dbPath + "/" + child);
+        }
+    }
+
+    parallelFor(tables.size(), [&](size_t i) {
+        uint64_t size;
+
+        if (!GetFileSize(tables[i], &size).ok()) {
+            return;
+        }
+
+        if (size <= maxWholeFileSize) {
+            auto data = std::make_shared<std::string>();
+
+            // Failures are ignored here, the table will just be read again when LevelDB opens it
+            if (readWholeFile(tables[i], *data).ok()) {
+                std::lock_guard<std::mutex> guard(prefetchedLock);
+
+                prefetched[tables[i]] = data;
+            }
+        } else {
+#if !defined(_WIN32) && defined(POSIX_FADV_WILLNEED)
+            int fd = open(tables[i].c_str(), O_RDONLY);
+
+            if (fd >= 0) {
+                posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+                close(fd);
+            }
+#endif
+        }
+    }, numThreads);
+}
+
+leveldb::Status PrefetchEnv::NewRandomAccessFile(const std::string &fname, leveldb::RandomAccessFile **result) {
+    if (!isTableFile(fname)) {
+        return target()->NewRandomAccessFile(fname, result);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(prefetchedLock);
+        auto it = prefetched.find(fname);
+
+        if (it != prefetched.end()) {
+            // LevelDB keeps the file open in its table cache, so we don't need to hold onto our copy
+            *result = new MemoryRandomAccessFile(it->second);
+            prefetched.erase(it);
+
+            return leveldb::Status::OK();
+        }
+    }
+
+    uint64_t size;
+    leveldb::Status status = GetFileSize(fname, &size);
+
+    if (!status.ok()) {
+        return status;
+    }
+
+    if (size <= maxWholeFileSize) {
+        auto data = std::make_shared<std::string>();
+
+        status = readWholeFile(fname, *data);
+
+        if (status.ok()) {
+            *result = new MemoryRandomAccessFile(data);
+        }
+
+        return status;
+    }
+
+#ifdef _WIN32
+    return target()->NewRandomAccessFile(fname, result);
+#else
+    int fd = open(fname.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+        return errnoToStatus(fname);
+    }
+
+    void *base = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (base == MAP_FAILED) {
+        status = errnoToStatus(fname);
+        close(fd);
+        return status;
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+
+    madvise(base, size, MADV_WILLNEED);
+
+    *result = new MmapRandomAccessFile((char *) base, size);
+
+    return leveldb::Status::OK();
+#endif
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "leveldb/env.h"
+
+/**
+ * An Env for databases on high-latency storage (e.g. network mounts), where LevelDB's many small random reads of
+ * table files are slow.
+ *
+ * Small tables are read in full with one large sequential read, optionally for all tables at once up front using a
+ * pool of threads, and then served from memory. Larger tables are memory-mapped with a hint to the OS to read them
+ * ahead.
+ */
+class PrefetchEnv : public leveldb::EnvWrapper {
+private:
+    size_t maxWholeFileSize;
+
+    std::mutex prefetchedLock;
+    std::map<std::string, std::shared_ptr<const std::string>> prefetched;
+
+    static bool isTableFile(const std::string &fname);
+
+    leveldb::Status readWholeFile(const std::string &fname, std::string &data);
+
+public:
+    PrefetchEnv(leveldb::Env *target, size_t maxWholeFileSize);
+
+    void prefetch(const std::string &dbPath, size_t numThreads);
+
+    leveldb::Status NewRandomAccessFile(const std::string &fname, leveldb::RandomAccessFile **result) override;
+};
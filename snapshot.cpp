@@ -0,0 +1,441 @@
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_set>
+
+#include "zlib.h"
+
+#include "snapshot.h"
+#include "common.h"
+
+/*
+ * Snapshot file layout (integers are little-endian, "varint" and "string" are as encoded by appendVarint64 and
+ * appendLengthPrefixed in common.cpp):
+ *
+ * Header:
+ *     "C42SNAP\0"
+ *     fixed32 version
+ *     byte    flags (SNAPSHOT_FLAG_OBFUSCATED if values are ciphertext rather than plaintext)
+ *     byte    compression (SnapshotCompression)
+ *     string  fingerprint of the obfuscation key (empty for plaintext snapshots)
+ *
+ * Blocks, each holding a run of entries in key order:
+ *     fixed32 stored length
+ *     fixed32 uncompressed length
+ *     fixed32 crc32 of the stored bytes
+ *     stored bytes, which decompress to a sequence of entries: string key, string value
+ *
+ *     (Uncompressed blocks are stored as-is, so both lengths are the same. Compressed blocks can't expand by more
+ *     than zlib's maximum ratio, which lets us reject a corrupt uncompressed length before allocating for it.)
+ *
+ * Index, one entry per block:
+ *     string  first key in the block
+ *     fixed64 file offset of the block
+ *     varint  number of entries in the block
+ *
+ * Footer:
+ *     fixed64 file offset of the index
+ *     fixed64 length of the index
+ *     fixed32 crc32 of the index
+ *     "C42SNAP\0"
+ */
+
+static const std::string SNAPSHOT_MAGIC("C42SNAP\0", 8);
+static const uint32_t SNAPSHOT_VERSION = 1;
+static const uint8_t SNAPSHOT_FLAG_OBFUSCATED = 0x01;
+
+static const size_t BLOCK_HEADER_SIZE = 12;
+static const size_t FOOTER_SIZE = 28;
+
+// Uncompressed size at which blocks are cut:
+static const size_t TARGET_BLOCK_SIZE = 64 * 1024;
+
+// Number of entries to decrypt in parallel during export:
+static const size_t EXPORT_CHUNK_ENTRIES = 4096;
+
+// Size of the WriteBatches which imported entries are committed in:
+static const size_t IMPORT_BATCH_BYTES = 4 * 1024 * 1024;
+
+// Largest ratio of uncompressed to compressed length that zlib can produce:
+static const uint64_t MAX_ZLIB_EXPANSION = 1032;
+
+SnapshotWriter::SnapshotWriter(const std::string &path, bool obfuscated, SnapshotCompression compression,
+        const std::string &keyFingerprint) : out(path, std::ios::binary | std::ios::trunc), offset(0),
+        compression(compression), blockEntries(0) {
+    if (!out) {
+        throw std::runtime_error("Failed to create snapshot file " + path);
+    }
+
+    std::string header(SNAPSHOT_MAGIC);
+
+    appendFixed32(header, SNAPSHOT_VERSION);
+    header.push_back((char) (obfuscated ? SNAPSHOT_FLAG_OBFUSCATED : 0));
+    header.push_back((char) compression);
+    appendLengthPrefixed(header, keyFingerprint);
+
+    write(header);
+}
+
+void SnapshotWriter::write(const std::string &data) {
+    out.write(data.data(), data.length());
+
+    if (!out) {
+        throw std::runtime_error("Failed to write to snapshot file");
+    }
+
+    offset += data.length();
+}
+
+void SnapshotWriter::add(const std::string &key, const std::string &value) {
+    if (blockEntries == 0) {
+        blockFirstKey = key;
+    }
+
+    appendLengthPrefixed(block, key);
+    appendLengthPrefixed(block, value);
+    blockEntries++;
+
+    if (block.length() >= TARGET_BLOCK_SIZE) {
+        flushBlock();
+    }
+}
+
+void SnapshotWriter::flushBlock() {
+    if (blockEntries == 0) {
+        return;
+    }
+
+    std::string stored;
+
+    if (compression == SC_ZLIB) {
+        uLongf storedLength = compressBound(block.length());
+
+        stored.resize(storedLength);
+
+        if (compress2((Bytef *) &stored[0], &storedLength, (const Bytef *) block.data(), block.length(),
+                Z_DEFAULT_COMPRESSION) != Z_OK) {
+            throw std::runtime_error("Failed to compress snapshot block");
+        }
+
+        stored.resize(storedLength);
+    } else {
+        stored = block;
+    }
+
+    appendLengthPrefixed(index, blockFirstKey);
+    appendFixed64(index, offset);
+    appendVarint64(index, blockEntries);
+
+    std::string header;
+
+    appendFixed32(header, stored.length());
+    appendFixed32(header, block.length());
+    appendFixed32(header, crc32Of(stored.data(), stored.length()));
+
+    write(header);
+    write(stored);
+
+    block.clear();
+    blockEntries = 0;
+}
+
+void SnapshotWriter::finish() {
+    flushBlock();
+
+    std::string footer;
+
+    appendFixed64(footer, offset);
+    appendFixed64(footer, index.length());
+    appendFixed32(footer, crc32Of(index.data(), index.length()));
+    footer.append(SNAPSHOT_MAGIC);
+
+    write(index);
+    write(footer);
+
+    out.close();
+
+    if (!out) {
+        throw std::runtime_error("Failed to write to snapshot file");
+    }
+}
+
+SnapshotReader::SnapshotReader(const std::string &path) {
+    try {
+        file.open(path);
+    } catch (std::exception &e) {
+        throw std::runtime_error("Failed to open snapshot file " + path + ": " + e.what());
+    }
+
+    const char *data = file.data();
+    const char *limit = data + file.size();
+
+    if (file.size() < SNAPSHOT_MAGIC.length() + 6 + FOOTER_SIZE
+            || SNAPSHOT_MAGIC.compare(0, std::string::npos, data, SNAPSHOT_MAGIC.length()) != 0
+            || SNAPSHOT_MAGIC.compare(0, std::string::npos, limit - SNAPSHOT_MAGIC.length(), SNAPSHOT_MAGIC.length()) != 0) {
+        throw std::runtime_error("Not a snapshot file: " + path);
+    }
+
+    const char *p = data + SNAPSHOT_MAGIC.length();
+
+    if (decodeFixed32(p) != SNAPSHOT_VERSION) {
+        throw std::runtime_error("Unsupported snapshot version in " + path);
+    }
+
+    obfuscated = (((uint8_t) p[4]) & SNAPSHOT_FLAG_OBFUSCATED) != 0;
+    compression = (SnapshotCompression) (uint8_t) p[5];
+    p += 6;
+
+    if (compression != SC_NONE && compression != SC_ZLIB) {
+        throw std::runtime_error("Unsupported snapshot compression in " + path);
+    }
+
+    const char *footer = limit - FOOTER_SIZE;
+
+    if (!readLengthPrefixed(p, footer, keyFingerprint)) {
+        throw std::runtime_error("Corrupt snapshot header in " + path);
+    }
+
+    uint64_t indexOffset = decodeFixed64(footer);
+    uint64_t indexLength = decodeFixed64(footer + 8);
+
+    if (indexOffset > (uint64_t) (footer - data) || indexLength != (uint64_t) (footer - data) - indexOffset
+            || crc32Of(data + indexOffset, indexLength) != decodeFixed32(footer + 16)) {
+        throw std::runtime_error("Corrupt snapshot index in " + path);
+    }
+
+    for (p = data + indexOffset; p < footer; ) {
+        IndexEntry entry;
+
+        if (!readLengthPrefixed(p, footer, entry.firstKey) || footer - p < 8) {
+            throw std::runtime_error("Corrupt snapshot index in " + path);
+        }
+
+        entry.offset = decodeFixed64(p);
+        p += 8;
+
+        if (!readVarint64(p, footer, entry.entries) || entry.offset + BLOCK_HEADER_SIZE > indexOffset) {
+            throw std::runtime_error("Corrupt snapshot index in " + path);
+        }
+
+        index.push_back(entry);
+    }
+}
+
+bool SnapshotReader::isObfuscated() const {
+    return obfuscated;
+}
+
+const std::string &SnapshotReader::getKeyFingerprint() const {
+    return keyFingerprint;
+}
+
+size_t SnapshotReader::getBlockCount() const {
+    return index.size();
+}
+
+void SnapshotReader::readBlock(size_t blockIndex, std::vector<std::pair<std::string, std::string>> &entries) const {
+    const IndexEntry &entry = index[blockIndex];
+    const char *header = file.data() + entry.offset;
+    uint32_t storedLength = decodeFixed32(header);
+    uint32_t rawLength = decodeFixed32(header + 4);
+    const char *stored = header + BLOCK_HEADER_SIZE;
+
+    if (storedLength > file.size() - entry.offset - BLOCK_HEADER_SIZE
+            || crc32Of(stored, storedLength) != decodeFixed32(header + 8)) {
+        throw std::runtime_error("Corrupt snapshot block");
+    }
+
+    // The CRC doesn't cover the header, so don't trust rawLength until it's been checked
+    if (compression == SC_ZLIB ? rawLength > (uint64_t) storedLength * MAX_ZLIB_EXPANSION : rawLength != storedLength) {
+        throw std::runtime_error("Corrupt snapshot block");
+    }
+
+    std::string decompressed;
+    const char *p = stored, *limit = stored + storedLength;
+
+    if (compression == SC_ZLIB) {
+        uLongf decompressedLength = rawLength;
+
+        decompressed.resize(rawLength);
+
+        if (uncompress((Bytef *) &decompressed[0], &decompressedLength, (const Bytef *) stored, storedLength) != Z_OK
+                || decompressedLength != rawLength) {
+            throw std::runtime_error("Corrupt snapshot block");
+        }
+
+        p = decompressed.data();
+        limit = p + decompressed.length();
+    }
+
+    entries.clear();
+    // Every entry takes at least two bytes
+    entries.reserve(std::min(entry.entries, (uint64_t) rawLength / 2));
+
+    while (p < limit) {
+        std::pair<std::string, std::string> pair;
+
+        if (!readLengthPrefixed(p, limit, pair.first) || !readLengthPrefixed(p, limit, pair.second)) {
+            throw std::runtime_error("Corrupt snapshot block");
+        }
+
+        entries.push_back(pair);
+    }
+}
+
+/**
+ * Look up a single key, only decoding the block which could contain it.
+ */
+bool SnapshotReader::get(const std::string &key, std::string &value) const {
+    // Find the last block whose first key is <= key
+    auto it = std::upper_bound(index.begin(), index.end(), key, [](const std::string &key, const IndexEntry &entry) {
+        return key < entry.firstKey;
+    });
+
+    if (it == index.begin()) {
+        return false;
+    }
+
+    std::vector<std::pair<std::string, std::string>> entries;
+
+    readBlock(it - index.begin() - 1, entries);
+
+    for (auto &entry : entries) {
+        if (entry.first == key) {
+            value = entry.second;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Write every entry of the database (read from a consistent snapshot of it) to a snapshot file.
+ *
+ * @param obfuscated - true to export the ciphertext as-is, false to decrypt values first
+ * @return the number of entries exported
+ */
+size_t exportSnapshot(ADB &adb, const std::string &path, bool obfuscated, SnapshotCompression compression) {
+    SnapshotWriter writer(path, obfuscated, compression, obfuscated ? adb.getKeyFingerprint() : "");
+    std::unique_ptr<ADBIterator> it = adb.newIterator();
+    std::vector<std::pair<std::string, std::string>> chunk;
+    size_t count = 0;
+
+    it->seekToFirst();
+
+    while (it->valid()) {
+        chunk.clear();
+
+        for (; it->valid() && chunk.size() < EXPORT_CHUNK_ENTRIES; it->next()) {
+            chunk.push_back(std::pair<std::string, std::string>(it->key().ToString(), it->rawValue().ToString()));
+        }
+
+        if (!obfuscated) {
+            parallelFor(chunk.size(), [&](size_t i) {
+                chunk[i].second = adb.deobfuscate(chunk[i].second);
+            });
+        }
+
+        for (auto &entry : chunk) {
+            writer.add(entry.first, entry.second);
+        }
+
+        count += chunk.size();
+    }
+
+    if (!it->status().ok()) {
+        throw std::runtime_error("Failed to read all entries from database: " + it->status().ToString());
+    }
+
+    writer.finish();
+
+    return count;
+}
+
+// Obfuscated values can only be decrypted with the key of the database they were exported from
+static void checkKeyFingerprint(ADB &adb, const SnapshotReader &reader) {
+    if (reader.isObfuscated() && reader.getKeyFingerprint() != adb.getKeyFingerprint()) {
+        throw std::runtime_error("Snapshot was exported from a database with a different obfuscation key, "
+            "export it again without --obfuscated or rekey the database first");
+    }
+}
+
+/**
+ * Write every entry from a snapshot file into the database, replacing the values of any keys that already exist.
+ *
+ * @param deleteMissing - true to also delete keys which aren't in the snapshot, so the database ends up matching it
+ *                        exactly (otherwise the snapshot is merged into the database)
+ */
+SnapshotImportResult importSnapshot(ADB &adb, const std::string &path, bool deleteMissing) {
+    SnapshotReader reader(path);
+
+    checkKeyFingerprint(adb, reader);
+
+    // So that undo reverts the whole import, not just its last batch
+    ADBUndoGroup undoGroup(adb);
+
+    std::vector<std::pair<std::string, std::string>> entries;
+    std::unordered_set<std::string> snapshotKeys;
+    ADBBatch batch;
+    size_t batchBytes = 0;
+    SnapshotImportResult result = {0, 0};
+
+    auto addToBatch = [&](size_t bytes) {
+        batchBytes += bytes;
+
+        if (batchBytes >= IMPORT_BATCH_BYTES) {
+            adb.apply(batch);
+            batch.clear();
+            batchBytes = 0;
+        }
+    };
+
+    for (size_t i = 0; i < reader.getBlockCount(); i++) {
+        reader.readBlock(i, entries);
+
+        for (auto &entry : entries) {
+            if (reader.isObfuscated()) {
+                batch.putObfuscated(entry.first, entry.second);
+            } else {
+                batch.put(entry.first, entry.second);
+            }
+
+            if (deleteMissing) {
+                snapshotKeys.insert(entry.first);
+            }
+
+            addToBatch(entry.first.length() + entry.second.length());
+        }
+
+        result.entries += entries.size();
+    }
+
+    if (deleteMissing) {
+        result.deleted = adb.forEachKeyNotIn(snapshotKeys, [&](const std::string &key) {
+            batch.remove(key);
+            addToBatch(key.length());
+        });
+    }
+
+    if (!batch.edits.empty()) {
+        adb.apply(batch);
+    }
+
+    return result;
+}
+
+/**
+ * Look up a single key in a snapshot file using its index, without reading the rest of the snapshot. The database is
+ * only used to decrypt the value if the snapshot is obfuscated.
+ */
+std::string readSnapshotKey(ADB &adb, const std::string &path, const std::string &key) {
+    SnapshotReader reader(path);
+    std::string value;
+
+    checkKeyFingerprint(adb, reader);
+
+    if (!reader.get(key, value)) {
+        throw ADBKeyNotFoundException("Failed to fetch " + key + ": not found in snapshot " + path);
+    }
+
+    return reader.isObfuscated() ? adb.deobfuscate(value) : value;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "boost/iostreams/device/mapped_file.hpp"
+
+#include "adb.h"
+
+enum SnapshotCompression {
+    SC_NONE = 0,
+    SC_ZLIB = 1
+};
+
+/**
+ * Streams database entries (in key order) out to a snapshot file. See snapshot.cpp for the file layout.
+ */
+class SnapshotWriter {
+private:
+    std::ofstream out;
+    uint64_t offset;
+    SnapshotCompression compression;
+
+    std::string block;
+    std::string blockFirstKey;
+    uint64_t blockEntries;
+
+    std::string index;
+
+    void write(const std::string &data);
+    void flushBlock();
+
+public:
+    SnapshotWriter(const std::string &path, bool obfuscated, SnapshotCompression compression,
+        const std::string &keyFingerprint);
+
+    void add(const std::string &key, const std::string &value);
+    void finish();
+};
+
+/**
+ * Reads a snapshot file through a memory mapping, either block-by-block or by looking up individual keys using the
+ * index.
+ */
+class SnapshotReader {
+private:
+    struct IndexEntry {
+        std::string firstKey;
+        uint64_t offset;
+        uint64_t entries;
+    };
+
+    boost::iostreams::mapped_file_source file;
+    bool obfuscated;
+    SnapshotCompression compression;
+    std::string keyFingerprint;
+    std::vector<IndexEntry> index;
+
+public:
+    explicit SnapshotReader(const std::string &path);
+
+    bool isObfuscated() const;
+    const std::string &getKeyFingerprint() const;
+
+    size_t getBlockCount() const;
+    void readBlock(size_t blockIndex, std::vector<std::pair<std::string, std::string>> &entries) const;
+
+    bool get(const std::string &key, std::string &value) const;
+};
+
+struct SnapshotImportResult {
+    size_t entries;
+    size_t deleted;
+};
+
+size_t exportSnapshot(ADB &adb, const std::string &path, bool obfuscated, SnapshotCompression compression);
+SnapshotImportResult importSnapshot(ADB &adb, const std::string &path, bool deleteMissing);
+std::string readSnapshotKey(ADB &adb, const std::string &path, const std::string &key);
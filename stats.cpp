@@ -0,0 +1,329 @@
+#include <iterator>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+#include "leveldb/env.h"
+#include "leveldb/table.h"
+
+#include "stats.h"
+#include "common.h"
+
+/*
+ * Reports on what's taking up space in a database. Besides the live entries, this counts every entry still present in
+ * the table and log files, since overwritten and deleted values stay there until a compaction discards them.
+ */
+
+static const int NUM_LEVELS = 7; // config::kNumLevels in LevelDB
+
+// The tag at the end of each internal key in a table, and each record of a WriteBatch, holds one of these types
+static const uint8_t TYPE_DELETION = 0x0;
+static const uint8_t TYPE_VALUE = 0x1;
+
+struct FileEntryCounts {
+    size_t values = 0;
+    size_t deletions = 0;
+};
+
+struct PrefixStats {
+    size_t keys = 0;
+    uint64_t plaintextBytes = 0;
+    uint64_t ciphertextBytes = 0;
+};
+
+static std::string jsonString(const std::string &value) {
+    static const char *HEX_DIGITS = "0123456789abcdef";
+    std::string result("\"");
+
+    for (char c : value) {
+        uint8_t byte = (uint8_t) c;
+
+        if (c == '"' || c == '\\') {
+            result.push_back('\\');
+            result.push_back(c);
+        } else if (byte < 0x20 || byte >= 0x7F) {
+            // Keys are arbitrary bytes, so represent each byte as the matching code point
+            result += "\\u00";
+            result.push_back(HEX_DIGITS[byte >> 4]);
+            result.push_back(HEX_DIGITS[byte & 0x0F]);
+        } else {
+            result.push_back(c);
+        }
+    }
+
+    result.push_back('"');
+
+    return result;
+}
+
+/**
+ * Group keys by their first segment, e.g. "\x01ui_http_keystore" belongs to "\x01ui_". Keys without a separator
+ * are a group by themselves.
+ */
+static std::string getKeyPrefix(const std::string &key) {
+    size_t separator = key.find_first_of("_.-:/", 1);
+
+    return separator == std::string::npos ? key : key.substr(0, separator + 1);
+}
+
+/**
+ * The first key which sorts after every key that starts with prefix (or empty if there is none).
+ */
+static std::string getPrefixLimit(std::string prefix) {
+    while (!prefix.empty() && (uint8_t) prefix.back() == 0xFF) {
+        prefix.pop_back();
+    }
+
+    if (!prefix.empty()) {
+        prefix.back() = (char) ((uint8_t) prefix.back() + 1);
+    }
+
+    return prefix;
+}
+
+static uint64_t getHistogramBucket(uint64_t size) {
+    uint64_t bucket = 1;
+
+    while (bucket < size) {
+        bucket <<= 1;
+    }
+
+    return size == 0 ? 0 : bucket;
+}
+
+static FileEntryCounts countTableEntries(leveldb::Env *env, const std::string &filename) {
+    FileEntryCounts result;
+    leveldb::RandomAccessFile *file;
+    leveldb::Table *table;
+    uint64_t size;
+    leveldb::Status status = env->GetFileSize(filename, &size);
+
+    if (status.ok()) {
+        status = env->NewRandomAccessFile(filename, &file);
+    }
+
+    if (!status.ok()) {
+        throw std::runtime_error(status.ToString());
+    }
+
+    status = leveldb::Table::Open(leveldb::Options(), file, size, &table);
+
+    if (!status.ok()) {
+        delete file;
+        throw std::runtime_error("Failed to open table " + filename + ": " + status.ToString());
+    }
+
+    leveldb::ReadOptions readOptions;
+    readOptions.fill_cache = false;
+
+    leveldb::Iterator *it = table->NewIterator(readOptions);
+
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        // Table keys are the user key followed by an 8-byte tag, whose low byte is the type
+        leveldb::Slice key = it->key();
+
+        if (key.size() >= 8 && (uint8_t) key[key.size() - 8] == TYPE_DELETION) {
+            result.deletions++;
+        } else {
+            result.values++;
+        }
+    }
+
+    status = it->status();
+
+    delete it;
+    delete table;
+    delete file;
+
+    if (!status.ok()) {
+        throw std::runtime_error("Failed to read table " + filename + ": " + status.ToString());
+    }
+
+    return result;
+}
+
+static void countWriteBatchEntries(const std::string &batch, FileEntryCounts &result) {
+    // Sequence number and count
+    const size_t BATCH_HEADER_SIZE = 12;
+
+    if (batch.length() < BATCH_HEADER_SIZE) {
+        return;
+    }
+
+    const char *p = batch.data() + BATCH_HEADER_SIZE;
+    const char *limit = batch.data() + batch.length();
+    std::string key, value;
+
+    while (p < limit) {
+        uint8_t type = (uint8_t) *p++;
+
+        if (type == TYPE_VALUE) {
+            if (!readLengthPrefixed(p, limit, key) || !readLengthPrefixed(p, limit, value)) {
+                return;
+            }
+            result.values++;
+        } else if (type == TYPE_DELETION) {
+            if (!readLengthPrefixed(p, limit, key)) {
+                return;
+            }
+            result.deletions++;
+        } else {
+            return;
+        }
+    }
+}
+
+/**
+ * Count the writes recorded in a log file. We stop at the first malformed record, since the tail of the log may not
+ * have been completely written.
+ */
+static FileEntryCounts countLogEntries(leveldb::Env *env, const std::string &filename) {
+    FileEntryCounts result;
+    std::string contents;
+    leveldb::Status status = leveldb::ReadFileToString(env, filename, &contents);
+
+    if (!status.ok()) {
+        throw std::runtime_error(status.ToString());
+    }
+
+    forEachLogRecord(contents, [&](const std::string &record) {
+        countWriteBatchEntries(record, result);
+    });
+
+    return result;
+}
+
+/**
+ * Write a JSON report on the keys, values and files of the database.
+ */
+void writeStatsJSON(ADB &adb, std::ostream &out) {
+    std::vector<std::pair<std::string, std::string>> entries;
+    std::unique_ptr<ADBIterator> it = adb.newIterator();
+
+    for (it->seekToFirst(); it->valid(); it->next()) {
+        entries.push_back(std::pair<std::string, std::string>(it->key().ToString(), it->rawValue().ToString()));
+    }
+
+    if (!it->status().ok()) {
+        throw std::runtime_error("Failed to read all entries from database: " + it->status().ToString());
+    }
+
+    it.reset();
+
+    std::vector<std::string> children, files;
+    leveldb::Env *env = adb.getEnv();
+
+    env->GetChildren(adb.getPath(), &children);
+
+    for (auto &child : children) {
+        if (hasSuffix(child, ".ldb") || hasSuffix(child, ".sst") || hasSuffix(child, ".log")) {
+            files.push_back(child);
+        }
+    }
+
+    // One pass over all of the work in parallel: decrypting each live entry, and reading each table and log file
+    std::vector<size_t> plaintextSizes(entries.size());
+    std::vector<FileEntryCounts> fileCounts(files.size());
+
+    parallelFor(entries.size() + files.size(), [&](size_t i) {
+        if (i < entries.size()) {
+            plaintextSizes[i] = adb.deobfuscate(entries[i].second).length();
+        } else {
+            size_t fileIndex = i - entries.size();
+            std::string filename = adb.getPath() + "/" + files[fileIndex];
+
+            if (hasSuffix(filename, ".log")) {
+                fileCounts[fileIndex] = countLogEntries(env, filename);
+            } else {
+                fileCounts[fileIndex] = countTableEntries(env, filename);
+            }
+        }
+    });
+
+    PrefixStats total;
+    size_t v1Keys = 0, v2Keys = 0;
+    std::map<std::string, PrefixStats> prefixes;
+    std::map<uint64_t, size_t> histogram;
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        const std::string &key = entries[i].first;
+
+        for (PrefixStats *stats : {&total, &prefixes[getKeyPrefix(key)]}) {
+            stats->keys++;
+            stats->plaintextBytes += plaintextSizes[i];
+            stats->ciphertextBytes += entries[i].second.length();
+        }
+
+        if (!key.empty() && key[0] == '\x01') {
+            v1Keys++;
+        } else if (!key.empty() && key[0] == '\x02') {
+            v2Keys++;
+        }
+
+        histogram[getHistogramBucket(plaintextSizes[i])]++;
+    }
+
+    out << "{" << std::endl;
+    out << "  \"entries\": " << total.keys << "," << std::endl;
+    out << "  \"v1Keys\": " << v1Keys << "," << std::endl;
+    out << "  \"v2Keys\": " << v2Keys << "," << std::endl;
+    out << "  \"plaintextBytes\": " << total.plaintextBytes << "," << std::endl;
+    out << "  \"ciphertextBytes\": " << total.ciphertextBytes << "," << std::endl;
+
+    out << "  \"keys\": [" << std::endl;
+    for (size_t i = 0; i < entries.size(); i++) {
+        out << "    {\"key\": " << jsonString(entries[i].first) << ", \"plaintextBytes\": " << plaintextSizes[i]
+            << ", \"ciphertextBytes\": " << entries[i].second.length() << "}" << (i + 1 < entries.size() ? "," : "")
+            << std::endl;
+    }
+    out << "  ]," << std::endl;
+
+    out << "  \"prefixes\": [" << std::endl;
+    for (auto prefix = prefixes.begin(); prefix != prefixes.end(); ++prefix) {
+        out << "    {\"prefix\": " << jsonString(prefix->first) << ", \"keys\": " << prefix->second.keys
+            << ", \"plaintextBytes\": " << prefix->second.plaintextBytes
+            << ", \"ciphertextBytes\": " << prefix->second.ciphertextBytes
+            << ", \"approximateDiskBytes\": " << adb.getApproximateSize(prefix->first, getPrefixLimit(prefix->first))
+            << "}" << (std::next(prefix) != prefixes.end() ? "," : "") << std::endl;
+    }
+    out << "  ]," << std::endl;
+
+    out << "  \"valueSizeHistogram\": [" << std::endl;
+    for (auto bucket = histogram.begin(); bucket != histogram.end(); ++bucket) {
+        out << "    {\"maxPlaintextBytes\": " << bucket->first << ", \"count\": " << bucket->second << "}"
+            << (std::next(bucket) != histogram.end() ? "," : "") << std::endl;
+    }
+    out << "  ]," << std::endl;
+
+    out << "  \"tablesPerLevel\": [";
+    for (int level = 0; level < NUM_LEVELS; level++) {
+        std::string count = adb.getProperty("leveldb.num-files-at-level" + std::to_string(level));
+
+        out << (count.empty() ? "0" : count) << (level + 1 < NUM_LEVELS ? ", " : "");
+    }
+    out << "]," << std::endl;
+
+    FileEntryCounts tableTotal, logTotal;
+    size_t numTables = 0, numLogs = 0;
+
+    for (size_t i = 0; i < files.size(); i++) {
+        bool isLog = hasSuffix(files[i], ".log");
+        FileEntryCounts &counts = isLog ? logTotal : tableTotal;
+
+        counts.values += fileCounts[i].values;
+        counts.deletions += fileCounts[i].deletions;
+
+        (isLog ? numLogs : numTables)++;
+    }
+
+    size_t allRecords = tableTotal.values + tableTotal.deletions + logTotal.values + logTotal.deletions;
+
+    out << "  \"tableFiles\": " << numTables << "," << std::endl;
+    out << "  \"tableValues\": " << tableTotal.values << "," << std::endl;
+    out << "  \"tableDeletions\": " << tableTotal.deletions << "," << std::endl;
+    out << "  \"logFiles\": " << numLogs << "," << std::endl;
+    out << "  \"logValues\": " << logTotal.values << "," << std::endl;
+    out << "  \"logDeletions\": " << logTotal.deletions << "," << std::endl;
+    out << "  \"obsoleteRecords\": " << (allRecords > total.keys ? allRecords - total.keys : 0) << std::endl;
+    out << "}" << std::endl;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <ostream>
+
+#include "adb.h"
+
+void writeStatsJSON(ADB &adb, std::ostream &out);
@@ -0,0 +1,239 @@
+/*
+ * Exercises the libc42adb interface (c42adb.h). Run by "make test" against a copy of the test database which has
+ * been rekeyed for the given Linux serial:
+ *
+ *     c42adb-test <database path> <linux serial>
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "../c42adb.h"
+
+static int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+            failures++; \
+        } \
+    } while (0)
+
+static std::string readValue(c42adb_t *db, const std::string &key, c42adb_status *status) {
+    char *value = nullptr;
+    size_t valueLength = 0;
+    std::string result;
+
+    *status = c42adb_read(db, key.data(), key.length(), &value, &valueLength, nullptr);
+
+    if (*status == C42ADB_OK) {
+        result.assign(value, valueLength);
+        c42adb_free(value);
+    }
+
+    return result;
+}
+
+static void testOpen(const char *path, const char *serial) {
+    c42adb_t *db = nullptr;
+    char *error = nullptr;
+
+    CHECK(c42adb_open(nullptr, nullptr, nullptr, &db, nullptr) == C42ADB_INVALID_ARGUMENT);
+
+    // The database is encrypted for a different machine, so this must fail...
+    CHECK(c42adb_open(path, nullptr, "ffffffffffffffffffffffffffffffff", &db, &error) == C42ADB_ERROR);
+    CHECK(error != nullptr);
+    c42adb_free(error);
+
+    // ...without leaving the database locked
+    error = nullptr;
+    CHECK(c42adb_open(path, nullptr, serial, &db, &error) == C42ADB_OK);
+    CHECK(error == nullptr);
+
+    c42adb_close(db);
+}
+
+static void testReadWrite(c42adb_t *db) {
+    c42adb_status status;
+    std::string missing("\x01" "no_such_key");
+    char *error = nullptr;
+    char *value = nullptr;
+    size_t valueLength;
+
+    CHECK(c42adb_read(db, missing.data(), missing.length(), &value, &valueLength, &error) == C42ADB_NOT_FOUND);
+    CHECK(error != nullptr);
+    c42adb_free(error);
+
+    CHECK(readValue(db, "\x01" "compliance_enforce", &status) == std::string(1, '\0'));
+    CHECK(status == C42ADB_OK);
+
+    std::string key("\x01" "hello");
+
+    CHECK(c42adb_write(db, key.data(), key.length(), "world", 5, nullptr) == C42ADB_OK);
+    CHECK(readValue(db, key, &status) == "world");
+    CHECK(status == C42ADB_OK);
+}
+
+static void testBatch(c42adb_t *db) {
+    c42adb_batch_t *batch = c42adb_batch_create();
+    std::string a("\x01" "a"), b("\x01" "b"), hello("\x01" "hello");
+    c42adb_status status;
+
+    c42adb_batch_put(batch, a.data(), a.length(), "1", 1);
+    c42adb_batch_put(batch, b.data(), b.length(), "2", 1);
+    c42adb_batch_delete(batch, hello.data(), hello.length());
+
+    CHECK(c42adb_apply(db, batch, nullptr) == C42ADB_OK);
+
+    c42adb_batch_destroy(batch);
+
+    CHECK(readValue(db, a, &status) == "1");
+    CHECK(readValue(db, b, &status) == "2");
+    readValue(db, hello, &status);
+    CHECK(status == C42ADB_NOT_FOUND);
+}
+
+static void testIterator(c42adb_t *db) {
+    c42adb_iterator_t *it = c42adb_iterator_create(db);
+    std::string a("\x01" "a");
+    const char *data;
+    size_t length;
+    size_t count = 0;
+
+    c42adb_iterator_seek(it, a.data(), a.length());
+
+    CHECK(c42adb_iterator_valid(it));
+    data = c42adb_iterator_key(it, &length);
+    CHECK(std::string(data, length) == a);
+    CHECK(c42adb_iterator_value(it, &data, &length, nullptr) == C42ADB_OK);
+    CHECK(std::string(data, length) == "1");
+
+    c42adb_iterator_next(it);
+
+    CHECK(c42adb_iterator_valid(it));
+    data = c42adb_iterator_key(it, &length);
+    CHECK(std::string(data, length) == "\x01" "b");
+    CHECK(c42adb_iterator_value(it, &data, &length, nullptr) == C42ADB_OK);
+    CHECK(std::string(data, length) == "2");
+
+    // Every value in the database must decrypt with the key we picked
+    for (c42adb_iterator_seek_to_first(it); c42adb_iterator_valid(it); c42adb_iterator_next(it)) {
+        CHECK(c42adb_iterator_value(it, &data, &length, nullptr) == C42ADB_OK);
+        count++;
+    }
+
+    CHECK(count > 2);
+    CHECK(c42adb_iterator_status(it, nullptr) == C42ADB_OK);
+
+    c42adb_iterator_destroy(it);
+}
+
+static void testWrappers(const char *path, const char *serial) {
+    std::unique_ptr<c42adb::Database> db;
+    std::string error, value;
+
+    CHECK(c42adb::Database::open(path, "", "ffffffffffffffffffffffffffffffff", &db, &error) == C42ADB_ERROR);
+    CHECK(!db && !error.empty());
+
+    CHECK(c42adb::Database::open(path, "", serial, &db) == C42ADB_OK);
+
+    c42adb::Batch batch;
+
+    batch.put("\x01" "c", "3");
+    batch.remove("\x01" "a");
+
+    CHECK(db->apply(batch) == C42ADB_OK);
+    CHECK(db->read("\x01" "c", &value) == C42ADB_OK && value == "3");
+    CHECK(db->read("\x01" "a", &value) == C42ADB_NOT_FOUND);
+
+    auto it = db->newIterator();
+    leveldb::Slice slice;
+
+    it->seek("\x01" "c");
+
+    CHECK(it->valid() && it->key() == "\x01" "c");
+    CHECK(it->value(&slice) == C42ADB_OK && slice == "3");
+}
+
+static bool fileExists(const std::string &path) {
+    FILE *file = fopen(path.c_str(), "rb");
+
+    if (file) {
+        fclose(file);
+    }
+
+    return file != nullptr;
+}
+
+static void testOptions(const char *path, const char *serial) {
+    std::string journalPath = std::string(path) + ".c42undo";
+    c42adb_options options;
+    c42adb_t *db = nullptr;
+
+    CHECK(c42adb_open_with_options(path, nullptr, serial, nullptr, &db, nullptr) == C42ADB_INVALID_ARGUMENT);
+
+    c42adb_options_init(&options);
+
+    CHECK(options.undoJournal && !options.skipUnchangedWrites);
+
+    options.undoJournal = 0;
+    options.skipUnchangedWrites = 1;
+    options.blockCacheSize = 1024 * 1024;
+    options.bloomFilterBitsPerKey = 10;
+
+    remove(journalPath.c_str());
+
+    CHECK(c42adb_open_with_options(path, nullptr, serial, &options, &db, nullptr) == C42ADB_OK);
+
+    std::string key("\x01" "options");
+    c42adb_status status;
+
+    CHECK(c42adb_write(db, key.data(), key.length(), "on", 2, nullptr) == C42ADB_OK);
+    CHECK(c42adb_write(db, key.data(), key.length(), "on", 2, nullptr) == C42ADB_OK);
+    CHECK(readValue(db, key, &status) == "on");
+    CHECK(!fileExists(journalPath));
+
+    c42adb_close(db);
+
+    std::unique_ptr<c42adb::Database> wrapped;
+
+    CHECK(c42adb::Database::open(path, "", serial, options, &wrapped) == C42ADB_OK);
+    CHECK(wrapped->remove(key) == C42ADB_OK);
+    CHECK(!fileExists(journalPath));
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        std::cerr << "Usage: c42adb-test <database path> <linux serial>" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    testOpen(argv[1], argv[2]);
+
+    c42adb_t *db = nullptr;
+
+    if (c42adb_open(argv[1], nullptr, argv[2], &db, nullptr) != C42ADB_OK) {
+        std::cerr << "Failed to open " << argv[1] << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    testReadWrite(db);
+    testBatch(db);
+    testIterator(db);
+
+    c42adb_close(db);
+
+    testWrappers(argv[1], argv[2]);
+    testOptions(argv[1], argv[2]);
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}